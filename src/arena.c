@@ -0,0 +1,134 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every allocation starts on a cache line, so arrays handed to different threads never share one
+#define ARENA_ALIGNMENT 64
+
+struct arena_block {
+    arena_block_t *prev;
+    size_t size;
+    size_t used;
+    unsigned char *data;
+};
+
+static size_t align_size(const size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static arena_block_t *create_arena_block(const size_t size, arena_block_t *prev)
+{
+    arena_block_t *block = (arena_block_t *)malloc(sizeof(arena_block_t));
+    if (!block) {
+        fprintf(stderr, "error allocating arena block\n");
+        return NULL;
+    }
+
+    block->data = (unsigned char *)aligned_alloc(ARENA_ALIGNMENT, align_size(size));
+    if (!block->data) {
+        fprintf(stderr, "error allocating arena block of %zu bytes\n", size);
+        free(block);
+        return NULL;
+    }
+    block->prev = prev;
+    block->size = align_size(size);
+    block->used = 0;
+
+    return block;
+}
+
+static void free_arena_blocks(arena_block_t *block)
+{
+    while (block) {
+        arena_block_t *prev = block->prev;
+        free(block->data);
+        free(block);
+        block = prev;
+    }
+}
+
+bool init_arena(arena_t *arena, const size_t size)
+{
+    *arena = (arena_t) { 0 };
+    arena->blocks = create_arena_block(size, NULL);
+    return arena->blocks != NULL;
+}
+
+void *arena_alloc(arena_t *arena, const size_t size)
+{
+    arena_block_t *block = arena->blocks;
+    const size_t aligned = align_size(size);
+
+    // Overflow blocks are at least as big as the block before, so a growing frame needs few of them
+    if (block->size - block->used < aligned) {
+        const size_t block_size = block->size > aligned ? block->size : aligned;
+        block = create_arena_block(block_size, block);
+        if (!block) {
+            return NULL;
+        }
+        arena->blocks = block;
+    }
+
+    void *ptr = block->data + block->used;
+    block->used += aligned;
+    arena->used += aligned;
+    if (arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
+
+    return ptr;
+}
+
+/*
+ * Grows the latest allocation in place when the block has room, otherwise moves it to a new allocation and the old
+ * one is only reclaimed by the next reset. Growing an array geometrically keeps the waste below its final size.
+ */
+void *arena_grow(arena_t *arena, void *ptr, const size_t old_size, const size_t new_size)
+{
+    arena_block_t *block = arena->blocks;
+    const size_t old_aligned = align_size(old_size);
+    const size_t new_aligned = align_size(new_size);
+
+    if (ptr && (unsigned char *)ptr + old_aligned == block->data + block->used
+        && block->size - block->used >= new_aligned - old_aligned) {
+        block->used += new_aligned - old_aligned;
+        arena->used += new_aligned - old_aligned;
+        if (arena->used > arena->high_water) {
+            arena->high_water = arena->used;
+        }
+        return ptr;
+    }
+
+    void *grown = arena_alloc(arena, new_size);
+    if (grown && ptr) {
+        memcpy(grown, ptr, old_size);
+    }
+    return grown;
+}
+
+// Releases everything allocated since the last reset, overflow blocks are merged into one for the next frame
+void reset_arena(arena_t *arena)
+{
+    if (arena->blocks->prev) {
+        arena_block_t *block = create_arena_block(arena->high_water, NULL);
+        if (block) {
+            free_arena_blocks(arena->blocks);
+            arena->blocks = block;
+        } else {
+            // Keep the newest block, it is the largest
+            free_arena_blocks(arena->blocks->prev);
+            arena->blocks->prev = NULL;
+        }
+    }
+
+    arena->blocks->used = 0;
+    arena->used = 0;
+}
+
+void free_arena(arena_t *arena)
+{
+    free_arena_blocks(arena->blocks);
+    *arena = (arena_t) { 0 };
+}
@@ -0,0 +1,26 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct arena_block arena_block_t;
+
+/*
+ * Linear allocator for data that lives for one frame. Allocations are bumped from a block and all of them are
+ * released at once by reset_arena(). A frame that outgrows the block chains on overflow blocks, and the next reset
+ * replaces them with a single block that holds the high-water mark, so a steady scene allocates nothing per frame.
+ */
+typedef struct {
+	arena_block_t *blocks; // the block being allocated from, chained to the ones it overflowed
+	size_t used;           // bytes allocated since the last reset, across all blocks
+	size_t high_water;     // most bytes any frame has allocated
+} arena_t;
+
+bool init_arena(arena_t *arena, const size_t size);
+void *arena_alloc(arena_t *arena, const size_t size);
+void *arena_grow(arena_t *arena, void *ptr, const size_t old_size, const size_t new_size);
+void reset_arena(arena_t *arena);
+void free_arena(arena_t *arena);
+
+#endif // ARENA_H_
@@ -35,6 +35,13 @@ int array_length(void *array)
     return (array != NULL) ? ARRAY_OCCUPIED(array) : 0;
 }
 
+void array_clear(void *array)
+{
+    if (array != NULL) {
+        ARRAY_OCCUPIED(array) = 0;
+    }
+}
+
 void array_free(void *array)
 {
     if (array != NULL) {
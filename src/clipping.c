@@ -6,21 +6,15 @@
 #include <stddef.h>
 
 #define NUM_FRUSTUM_PLANES 6
+#define NUM_CLIP_PLANES 10
 
 plane_t frustum_planes[NUM_FRUSTUM_PLANES];
 
-#define LERP(a, b, t) _Generic((a), int: int_lerp, float: float_lerp)(a, b, t)
-
 static float float_lerp(const float a, const float b, const float t)
 {
     return a + t * (b - a);
 }
 
-static int int_lerp(const int a, const int b, const int t)
-{
-    return a + t * (b - a);
-}
-
 void init_frustum_planes(const float fovx, const float fovy, const float znear, const float zfar)
 {
     const float cos_half_fovx = cos(fovx / 2);
@@ -48,7 +42,7 @@ void init_frustum_planes(const float fovx, const float fovy, const float znear,
 }
 
 polygon_t poly_from_triangle(
-    const vec3_t v0, const vec3_t v1, const vec3_t v2,
+    const vec4_t v0, const vec4_t v1, const vec4_t v2,
     const tex2_t t0, const tex2_t t1, const tex2_t t2
 )
 {
@@ -68,9 +62,9 @@ int triangles_from_poly(const polygon_t *polygon, triangle_t *triangles)
         idx1 = i + 1;
         idx2 = i + 2;
 
-        triangles[i].points[0] = vec4_from_vec3(polygon->vertices[idx0]);
-        triangles[i].points[1] = vec4_from_vec3(polygon->vertices[idx1]);
-        triangles[i].points[2] = vec4_from_vec3(polygon->vertices[idx2]);
+        triangles[i].points[0] = polygon->vertices[idx0];
+        triangles[i].points[1] = polygon->vertices[idx1];
+        triangles[i].points[2] = polygon->vertices[idx2];
 
         triangles[i].texcoords[0] = polygon->texcoords[idx0];
         triangles[i].texcoords[1] = polygon->texcoords[idx1];
@@ -79,79 +73,165 @@ int triangles_from_poly(const polygon_t *polygon, triangle_t *triangles)
     return polygon->num_vertices - 2;
 }
 
-void clip_polygon_against_plane(polygon_t *polygon, const int plane)
+/*
+ * Signed distance of a clip space vertex from a frustum plane, scaled by the plane's normal, non-negative inside.
+ * The planes are -w <= x <= w, -w <= y <= w and 0 <= z <= w for the projection from mat4_make_perspective(), and
+ * the guard band planes are the side planes at GUARD_BAND_SCALE * w.
+ */
+static float get_clip_distance(const vec4_t v, const int plane)
 {
-    vec3_t plane_point = frustum_planes[plane].point;
-    vec3_t plane_normal = frustum_planes[plane].normal;
-
-    vec3_t inside_vertices[MAX_VERTICES_PER_POLY] = { 0 };
-    tex2_t inside_texcoords[MAX_VERTICES_PER_POLY] = { 0 };
-    size_t num_inside_vertices = 0;
-
-    vec3_t *cur_vertex = &polygon->vertices[0];
-    tex2_t *cur_texcoord = &polygon->texcoords[0];
-
-    vec3_t *prev_vertex = &polygon->vertices[polygon->num_vertices - 1];
-    tex2_t *prev_texcoord = &polygon->texcoords[polygon->num_vertices - 1];
-
-    float cur_dot = 0;
-    float prev_dot = vec3_dot(vec3_sub(*prev_vertex, plane_point), plane_normal);
+    switch (plane) {
+        case LEFT_FRUSTUM_PLANE:
+            return v.w + v.x;
+        case RIGHT_FRUSTUM_PLANE:
+            return v.w - v.x;
+        case TOP_FRUSTUM_PLANE:
+            return v.w - v.y;
+        case BOTTOM_FRUSTUM_PLANE:
+            return v.w + v.y;
+        case NEAR_FRUSTUM_PLANE:
+            return v.z;
+        case FAR_FRUSTUM_PLANE:
+            return v.w - v.z;
+        case LEFT_GUARD_BAND_PLANE:
+            return (GUARD_BAND_SCALE * v.w) + v.x;
+        case RIGHT_GUARD_BAND_PLANE:
+            return (GUARD_BAND_SCALE * v.w) - v.x;
+        case TOP_GUARD_BAND_PLANE:
+            return (GUARD_BAND_SCALE * v.w) - v.y;
+        default:
+            return (GUARD_BAND_SCALE * v.w) + v.y;
+    }
+}
 
-    while (cur_vertex != &polygon->vertices[polygon->num_vertices]) {
-        cur_dot = vec3_dot(vec3_sub(*cur_vertex, plane_point), plane_normal);
+uint16_t get_clip_outcode(const vec4_t v)
+{
+    uint16_t outcode = 0;
+    for (int plane = 0; plane < NUM_CLIP_PLANES; plane++) {
+        if (get_clip_distance(v, plane) < 0) {
+            outcode |= 1 << plane;
+        }
+    }
+    return outcode;
+}
 
-        // Check if inside or outside of frustum (side of the plane in question)
-        if (cur_dot * prev_dot < 0) {
-            // Find the interpolation factor t where t is a value between the beginning (Q1) and end (Q2) of a
-            // line segment and is between 0 and 1
-            const float t = prev_dot / (prev_dot - cur_dot);
+// Outcodes of count vertices from first of some clip space streams, once per frame however many faces share each
+void get_clip_outcodes(const vertex_soa_t *vertices, uint16_t *outcodes, const int first, const int count)
+{
+    for (int i = first; i < first + count; i++) {
+        outcodes[i] = get_clip_outcode(get_vertex_soa(vertices, i));
+    }
+}
 
-            // Calculate the intersection point I where I = Q1 + t(Q2 - Q1)
-            vec3_t intersection_point = {
-                .x = LERP(prev_vertex->x, cur_vertex->x, t),
-                .y = LERP(prev_vertex->y, cur_vertex->y, t),
-                .z = LERP(prev_vertex->z, cur_vertex->z, t),
+// Sutherland-Hodgman against one plane, from one buffer into the other
+static void clip_polygon_against_plane(const polygon_t *polygon, polygon_t *clipped, const int plane)
+{
+    clipped->num_vertices = 0;
+
+    int prev = polygon->num_vertices - 1;
+    float prev_distance = get_clip_distance(polygon->vertices[prev], plane);
+
+    for (int cur = 0; cur < polygon->num_vertices; cur++) {
+        const float cur_distance = get_clip_distance(polygon->vertices[cur], plane);
+
+        // The edge crosses the plane, add the intersection I = Q1 + t(Q2 - Q1)
+        if ((prev_distance < 0) != (cur_distance < 0)) {
+            const float t = prev_distance / (prev_distance - cur_distance);
+            const vec4_t *a = &polygon->vertices[prev];
+            const vec4_t *b = &polygon->vertices[cur];
+            const tex2_t *ta = &polygon->texcoords[prev];
+            const tex2_t *tb = &polygon->texcoords[cur];
+
+            clipped->vertices[clipped->num_vertices] = (vec4_t) {
+                .x = float_lerp(a->x, b->x, t),
+                .y = float_lerp(a->y, b->y, t),
+                .z = float_lerp(a->z, b->z, t),
+                .w = float_lerp(a->w, b->w, t),
             };
-
-            // Use lerp (linear interpolation) formula to get interpolated UV texture coords
-            tex2_t interpolated_texcoord = {
-                .u = LERP(prev_texcoord->u, cur_texcoord->u, t),
-                .v = LERP(prev_texcoord->v, cur_texcoord->v, t),
+            clipped->texcoords[clipped->num_vertices] = (tex2_t) {
+                .u = float_lerp(ta->u, tb->u, t),
+                .v = float_lerp(ta->v, tb->v, t),
             };
-
-            // Add intersection point to inside vertices
-            inside_vertices[num_inside_vertices] = vec3_clone(&intersection_point);
-            inside_texcoords[num_inside_vertices] = tex2_clone(&interpolated_texcoord);
-            num_inside_vertices++;
+            clipped->num_vertices++;
         }
 
-        // Current vertex is inside the frustum (side of the plane in question)
-        if (cur_dot > 0) {
-            inside_vertices[num_inside_vertices] = vec3_clone(cur_vertex);
-            inside_texcoords[num_inside_vertices] = tex2_clone(cur_texcoord);
-            num_inside_vertices++;
+        // Current vertex is inside the plane in question
+        if (!(cur_distance < 0)) {
+            clipped->vertices[clipped->num_vertices] = polygon->vertices[cur];
+            clipped->texcoords[clipped->num_vertices] = polygon->texcoords[cur];
+            clipped->num_vertices++;
         }
 
-        prev_dot = cur_dot;
-        prev_vertex = cur_vertex;
-        prev_texcoord = cur_texcoord;
-        cur_vertex++;
-        cur_texcoord++;
+        prev = cur;
+        prev_distance = cur_distance;
     }
+}
+
+/*
+ * Clips a clip space polygon against only the planes set in planes, the planes from the union of its vertices'
+ * outcodes that it needs clipping against. Each pass reads one of the two buffers and writes the other, and the
+ * buffer holding the result is returned.
+ */
+const polygon_t *clip_polygon(polygon_t *polygon, polygon_t *scratch, const uint16_t planes)
+{
+    polygon_t *src = polygon;
+    polygon_t *dst = scratch;
 
-    for (size_t i = 0; i < num_inside_vertices; i++) {
-        polygon->vertices[i] = vec3_clone(&inside_vertices[i]);
-        polygon->texcoords[i] = tex2_clone(&inside_texcoords[i]);
+    for (int plane = 0; plane < NUM_CLIP_PLANES && src->num_vertices > 0; plane++) {
+        if (planes & (1 << plane)) {
+            clip_polygon_against_plane(src, dst, plane);
+
+            polygon_t *tmp = src;
+            src = dst;
+            dst = tmp;
+        }
     }
-    polygon->num_vertices = num_inside_vertices;
+    return src;
+}
+
+static float get_plane_distance(const int plane, const vec3_t point)
+{
+    return vec3_dot(vec3_sub(point, frustum_planes[plane].point), frustum_planes[plane].normal);
 }
 
-void clip_polygon(polygon_t *polygon)
+// Where a camera space bounding sphere lies relative to the frustum
+frustum_test_t test_sphere_in_frustum(const vec3_t centre, const float radius)
 {
-    clip_polygon_against_plane(polygon, LEFT_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, RIGHT_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, TOP_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, BOTTOM_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, NEAR_FRUSTUM_PLANE);
-    clip_polygon_against_plane(polygon, FAR_FRUSTUM_PLANE);
+    frustum_test_t result = FRUSTUM_INSIDE;
+    for (int plane = 0; plane < NUM_FRUSTUM_PLANES; plane++) {
+        const float distance = get_plane_distance(plane, centre);
+        if (distance < -radius) {
+            return FRUSTUM_OUTSIDE;
+        }
+        if (!(distance > radius)) {
+            result = FRUSTUM_INTERSECTING;
+        }
+    }
+    return result;
+}
+
+/*
+ * Where the convex hull of some camera space points lies relative to the frustum. Inside means no polygon within the
+ * hull needs clipping, and outside means every point is behind the same plane, so clipping would remove every
+ * polygon within the hull.
+ */
+frustum_test_t test_points_in_frustum(const vec3_t *points, const int num_points)
+{
+    frustum_test_t result = FRUSTUM_INSIDE;
+    for (int plane = 0; plane < NUM_FRUSTUM_PLANES; plane++) {
+        int num_behind = 0;
+        for (int i = 0; i < num_points; i++) {
+            const float distance = get_plane_distance(plane, points[i]);
+            if (distance < 0) {
+                num_behind++;
+            }
+            if (!(distance > 0)) {
+                result = FRUSTUM_INTERSECTING;
+            }
+        }
+        if (num_behind == num_points) {
+            return FRUSTUM_OUTSIDE;
+        }
+    }
+    return result;
 }
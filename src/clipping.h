@@ -4,7 +4,11 @@
 #include "texture.h"
 #include "triangle.h"
 #include "vector.h"
+#include "vertex.h"
+#include <stdbool.h>
+#include <stdint.h>
 
+// Also the bit of each plane in a clip space outcode
 enum {
 	LEFT_FRUSTUM_PLANE,
 	RIGHT_FRUSTUM_PLANE,
@@ -12,8 +16,29 @@ enum {
 	BOTTOM_FRUSTUM_PLANE,
 	NEAR_FRUSTUM_PLANE,
 	FAR_FRUSTUM_PLANE,
+	LEFT_GUARD_BAND_PLANE, // the side planes pushed out to GUARD_BAND_SCALE times the viewport
+	RIGHT_GUARD_BAND_PLANE,
+	TOP_GUARD_BAND_PLANE,
+	BOTTOM_GUARD_BAND_PLANE,
 };
 
+/*
+ * Triangles that only cross the side planes within the guard band are not clipped, the rasteriser scissors them
+ * to the screen with their bounding box instead. The band keeps screen coordinates far inside the range of the
+ * rasteriser's fixed point vertices.
+ */
+#define GUARD_BAND_SCALE 4.0f
+
+#define FRUSTUM_CLIP_PLANES 0x3F
+#define GUARD_BAND_CLIP_PLANES \
+	((1 << NEAR_FRUSTUM_PLANE) | (1 << FAR_FRUSTUM_PLANE) | (0xF << LEFT_GUARD_BAND_PLANE))
+
+typedef enum {
+	FRUSTUM_OUTSIDE,
+	FRUSTUM_INTERSECTING,
+	FRUSTUM_INSIDE,
+} frustum_test_t;
+
 typedef struct {
 	vec3_t point;
 	vec3_t normal;
@@ -22,19 +47,23 @@ typedef struct {
 #define MAX_VERTICES_PER_POLY 10
 #define MAX_TRIANGLES_PER_POLY 10
 
+// A triangle in clip space, before the perspective divide, as it is clipped
 typedef struct {
-	vec3_t vertices[MAX_VERTICES_PER_POLY];
+	vec4_t vertices[MAX_VERTICES_PER_POLY];
 	tex2_t texcoords[MAX_VERTICES_PER_POLY];
 	int num_vertices;
 } polygon_t;
 
 void init_frustum_planes(const float fovx, const float fovy, const float znear, const float zfar);
 polygon_t poly_from_triangle(
-    const vec3_t v0, const vec3_t v1, const vec3_t v2,
+    const vec4_t v0, const vec4_t v1, const vec4_t v2,
     const tex2_t t0, const tex2_t t1, const tex2_t t2
 );
 int triangles_from_poly(const polygon_t *polygon, triangle_t *triangles);
-void clip_polygon_against_plane(polygon_t *polygon, const int plane);
-void clip_polygon(polygon_t *polygon);
+uint16_t get_clip_outcode(const vec4_t v);
+void get_clip_outcodes(const vertex_soa_t *vertices, uint16_t *outcodes, const int first, const int count);
+const polygon_t *clip_polygon(polygon_t *polygon, polygon_t *scratch, const uint16_t planes);
+frustum_test_t test_sphere_in_frustum(const vec3_t centre, const float radius);
+frustum_test_t test_points_in_frustum(const vec3_t *points, const int num_points);
 
 #endif // CLIPPING_H_
@@ -2,19 +2,36 @@
 #include "display.h"
 #include "light.h"
 #include "triangle.h"
+#include <stdlib.h>
 
 static enum cull_method cull_method = 0;
 static enum render_method render_method = 0;
 
+static enum sort_method sort_method = 0;
+static enum clip_method clip_method = 0;
+static enum pipeline_method pipeline_method = 0;
+
+// Rasteriser counters of the last frame, shown in the UI
+static raster_stats_t raster_stats = { 0 };
+
+// Pixels shaded by the latest frame drawn in each order, -1 until one has been drawn, the difference is what the
+// front to back sort saves
+static int sorted_pixels_shaded = -1;
+static int unsorted_pixels_shaded = -1;
+
 static int win_width = 800;
 static int win_height = 600;
 
 static SDL_Window *window = NULL;
 static SDL_Renderer *renderer = NULL;
 
-static uint32_t *colour_buf = NULL;
 static SDL_Texture *colour_buf_tex = NULL;
-static float *zbuf = NULL;
+
+// Render target, cleared to the background at the start of every frame
+static framebuffer_t *framebuffer = NULL;
+
+// Id of the triangle covering each pixel in RENDER_TEXTURED_VISIBILITY, valid wherever depth was written
+static uint32_t *vis_buf = NULL;
 
 int get_win_width(void)
 {
@@ -26,20 +43,14 @@ int get_win_height(void)
     return win_height;
 }
 
-float get_zbuf_at(const int x, const int y)
+framebuffer_t *get_framebuffer(void)
 {
-    if (x < 0 || x >= win_width || y < 0 || y >= win_height) {
-        return 1.0;
-    }
-    return zbuf[(win_width * y) + x];
+    return framebuffer;
 }
 
-void update_zbuf_at(const int x, const int y, float value)
+uint32_t *get_vis_buf(void)
 {
-    if (x < 0 || x >= win_width || y < 0 || y >= win_height) {
-        return;
-    }
-    zbuf[(win_width * y) + x] = value;
+    return vis_buf;
 }
 
 void set_render_method(const int rm)
@@ -52,11 +63,51 @@ void set_cull_method(const int cm)
     cull_method = cm;
 }
 
+void set_sort_method(const int sm)
+{
+    sort_method = sm;
+}
+
+void set_clip_method(const int cm)
+{
+    clip_method = cm;
+}
+
+void set_pipeline_method(const int pm)
+{
+    pipeline_method = pm;
+}
+
+void set_raster_stats(const raster_stats_t stats, const bool sorted)
+{
+    raster_stats = stats;
+    if (sorted) {
+        sorted_pixels_shaded = stats.pixels_shaded;
+    } else {
+        unsorted_pixels_shaded = stats.pixels_shaded;
+    }
+}
+
 bool should_cull_backface(void)
 {
     return cull_method == CULL_BACKFACE;
 }
 
+bool should_sort_front_to_back(void)
+{
+    return sort_method == SORT_FRONT_TO_BACK;
+}
+
+bool should_clip_guard_band(void)
+{
+    return clip_method == CLIP_GUARD_BAND;
+}
+
+bool should_pipeline_frames(void)
+{
+    return pipeline_method == PIPELINE_OVERLAPPED;
+}
+
 bool should_render_filled_triangles(void)
 {
     return render_method == RENDER_FILL_TRIANGLE || render_method == RENDER_FILL_TRIANGLE_WIRE;
@@ -67,6 +118,11 @@ bool should_render_texture_triangles(void)
     return render_method == RENDER_TEXTURED || render_method == RENDER_TEXTURED_WIRE;
 }
 
+bool should_render_visibility_buffer(void)
+{
+    return render_method == RENDER_TEXTURED_VISIBILITY;
+}
+
 bool should_render_vertices(void)
 {
     return render_method == RENDER_WIRE_VERTEX;
@@ -118,15 +174,14 @@ bool init_win(const bool debug)
         return false;
     }
 
-    colour_buf = (uint32_t *)malloc(sizeof(uint32_t) * win_width * win_height);
-    if (!colour_buf) {
-        fprintf(stderr, "error allocating colour buffer\n");
+    framebuffer = create_framebuffer(win_width, win_height);
+    if (!framebuffer) {
         return false;
     }
 
-    zbuf = (float *)malloc(sizeof(float) * win_width * win_height);
-    if (!zbuf) {
-        fprintf(stderr, "error allocating z buffer\n");
+    vis_buf = (uint32_t *)malloc(sizeof(uint32_t) * win_width * win_height);
+    if (!vis_buf) {
+        fprintf(stderr, "error allocating visibility buffer\n");
         return false;
     }
 
@@ -151,17 +206,15 @@ bool init_win(const bool debug)
     return true;
 }
 
-void clear_colour_buf(const uint32_t colour)
+// Resets colour, depth and the farthest depth of every tile, then dots the grid over the cleared colour
+void draw_background(void)
 {
-    for (size_t i = 0; i < (size_t)win_height * win_width; i++) {
-        colour_buf[i] = colour;
-    }
-}
+    clear_framebuffer(framebuffer, 0xFF000000);
 
-void clear_zbuf(void)
-{
-    for (size_t i = 0; i < (size_t)win_height * win_width; i++) {
-        zbuf[i] = 1.0;
+    for (int y = 0; y < win_height; y += 10) {
+        for (int x = 0; x < win_width; x += 10) {
+            get_framebuffer_row(framebuffer, x, y)->colour[x % FRAMEBUFFER_TILE_SIZE] = 0xFF333333;
+        }
     }
 }
 
@@ -174,12 +227,15 @@ void render_display(void)
 
 void render_colour_buf(void)
 {
-    SDL_UpdateTexture(
-        colour_buf_tex,
-        NULL,
-        colour_buf,
-        win_width * sizeof(uint32_t)
-    );
+    void *pixels = NULL;
+    int pitch = 0;
+    if (SDL_LockTexture(colour_buf_tex, NULL, &pixels, &pitch) != 0) {
+        fprintf(stderr, "error locking colour buffer texture: %s\n", SDL_GetError());
+        return;
+    }
+    resolve_framebuffer(framebuffer, pixels, pitch);
+    SDL_UnlockTexture(colour_buf_tex);
+
     SDL_RenderCopy(renderer, colour_buf_tex, NULL, NULL);
 }
 
@@ -188,29 +244,110 @@ void draw_pixel(const int x, const int y, const uint32_t colour)
     if (x < 0 || x >= win_width || y < 0 || y >= win_height) {
         return;
     }
-    colour_buf[(win_width * y) + x] = colour;
+    get_framebuffer_row(framebuffer, x, y)->colour[x % FRAMEBUFFER_TILE_SIZE] = colour;
 }
 
-void draw_line(const int x0, const int y0, const int x1, const int y1, const uint32_t colour)
+// Cohen-Sutherland region of a point relative to the screen
+enum outcode {
+    OUTCODE_INSIDE = 0,
+    OUTCODE_LEFT = 1,
+    OUTCODE_RIGHT = 2,
+    OUTCODE_TOP = 4,
+    OUTCODE_BOTTOM = 8
+};
+
+static int get_outcode(const int x, const int y)
 {
-    // m = Δx/Δy = rise/run
-    int delta_x = x1 - x0;
-    int delta_y = y1 - y0;
+    int code = OUTCODE_INSIDE;
+    if (x < 0) {
+        code |= OUTCODE_LEFT;
+    } else if (x >= win_width) {
+        code |= OUTCODE_RIGHT;
+    }
+    if (y < 0) {
+        code |= OUTCODE_TOP;
+    } else if (y >= win_height) {
+        code |= OUTCODE_BOTTOM;
+    }
+    return code;
+}
 
-    int longest_side_len = abs(delta_x) >= abs(delta_y) ? abs(delta_x) : abs(delta_y);
+// Clips the line to the screen, returns false if none of it is on screen
+static bool clip_line(int *x0, int *y0, int *x1, int *y1)
+{
+    int code0 = get_outcode(*x0, *y0);
+    int code1 = get_outcode(*x1, *y1);
 
-    // Calculate the x and y increment at which to draw
-    float x_inc = delta_x / (float)longest_side_len;
-    float y_inc = delta_y / (float)longest_side_len;
+    while (code0 | code1) {
+        // Both ends are on the outside of the same screen edge
+        if (code0 & code1) {
+            return false;
+        }
 
-    // The current x and y at which to draw a pixel
-    float cur_x = x0;
-    float cur_y = y0;
+        // Move the end that is outside onto the edge it is beyond
+        const int code = code0 ? code0 : code1;
+        const int64_t dx = *x1 - *x0;
+        const int64_t dy = *y1 - *y0;
+        int x, y;
+
+        if (code & OUTCODE_TOP) {
+            x = *x0 + (int)(dx * (0 - *y0) / dy);
+            y = 0;
+        } else if (code & OUTCODE_BOTTOM) {
+            x = *x0 + (int)(dx * (win_height - 1 - *y0) / dy);
+            y = win_height - 1;
+        } else if (code & OUTCODE_LEFT) {
+            x = 0;
+            y = *y0 + (int)(dy * (0 - *x0) / dx);
+        } else {
+            x = win_width - 1;
+            y = *y0 + (int)(dy * (win_width - 1 - *x0) / dx);
+        }
 
-    for (size_t i = 0; i <= (size_t)longest_side_len; i++) {
-        draw_pixel(round(cur_x), round(cur_y), colour);
-        cur_x += x_inc;
-        cur_y += y_inc;
+        if (code == code0) {
+            *x0 = x;
+            *y0 = y;
+            code0 = get_outcode(x, y);
+        } else {
+            *x1 = x;
+            *y1 = y;
+            code1 = get_outcode(x, y);
+        }
+    }
+
+    return true;
+}
+
+// Bresenham line, clipped to the screen up front so that the pixels can be written without bounds checks
+void draw_line(int x0, int y0, int x1, int y1, const uint32_t colour)
+{
+    if (!clip_line(&x0, &y0, &x1, &y1)) {
+        return;
+    }
+
+    const int delta_x = abs(x1 - x0);
+    const int delta_y = -abs(y1 - y0);
+    const int step_x = x0 < x1 ? 1 : -1;
+    const int step_y = y0 < y1 ? 1 : -1;
+
+    // Error term of both axes, stepping along x adds delta_y and stepping along y adds delta_x
+    int err = delta_x + delta_y;
+
+    for (;;) {
+        get_framebuffer_row(framebuffer, x0, y0)->colour[x0 % FRAMEBUFFER_TILE_SIZE] = colour;
+        if (x0 == x1 && y0 == y1) {
+            break;
+        }
+
+        const int err2 = err * 2;
+        if (err2 >= delta_y) {
+            err += delta_y;
+            x0 += step_x;
+        }
+        if (err2 <= delta_x) {
+            err += delta_x;
+            y0 += step_y;
+        }
     }
 }
 
@@ -226,16 +363,8 @@ void draw_rect(const int x, const int y, const int w, const int h, const uint32_
     }
 }
 
-void draw_grid(void)
-{
-    for (size_t y = 0; y < (size_t)win_height; y += 10) {
-        for (size_t x = 0; x < (size_t)win_width; x += 10) {
-            colour_buf[(win_width * y) + x] = 0xFF333333;
-        }
-    }
-}
 
-#define UI_LEN 15
+#define UI_LEN 23
 
 void render_ui(SDL_Renderer *renderer)
 {
@@ -252,8 +381,16 @@ void render_ui(SDL_Renderer *renderer)
         "<4> - fill triangle wire",
         "<5> - textured",
         "<6> - textured wire",
+        "<7> - textured visibility buffer",
         "<c> - cull backface",
         "<x> - cull none",
+        "<o> - sort front to back",
+        "<u> - sort none",
+        "<p> - affine spans",
+        "<f> - clip frustum",
+        "<g> - clip guard band",
+        "<k> - frames serial",
+        "<l> - frames pipelined",
         "<w> - pitch up",
         "<s> - pitch down",
         "<a> - turn left",
@@ -306,22 +443,103 @@ void render_ui(SDL_Renderer *renderer)
         draw_text(renderer, font, ui[5], 15, 15 * 5 + 10, white);
     }
 
-    if (cull_method == CULL_BACKFACE) {
+    if (render_method == RENDER_TEXTURED_VISIBILITY) {
         draw_text(renderer, font, ui[6], 15, 15 * 6 + 10, green);
     } else {
         draw_text(renderer, font, ui[6], 15, 15 * 6 + 10, white);
     }
 
-    if (cull_method == CULL_NONE) {
+    if (cull_method == CULL_BACKFACE) {
         draw_text(renderer, font, ui[7], 15, 15 * 7 + 10, green);
     } else {
         draw_text(renderer, font, ui[7], 15, 15 * 7 + 10, white);
     }
 
-    for (size_t i = 8; i < UI_LEN; i++) {
+    if (cull_method == CULL_NONE) {
+        draw_text(renderer, font, ui[8], 15, 15 * 8 + 10, green);
+    } else {
+        draw_text(renderer, font, ui[8], 15, 15 * 8 + 10, white);
+    }
+
+    if (sort_method == SORT_FRONT_TO_BACK) {
+        draw_text(renderer, font, ui[9], 15, 15 * 9 + 10, green);
+    } else {
+        draw_text(renderer, font, ui[9], 15, 15 * 9 + 10, white);
+    }
+
+    if (sort_method == SORT_NONE) {
+        draw_text(renderer, font, ui[10], 15, 15 * 10 + 10, green);
+    } else {
+        draw_text(renderer, font, ui[10], 15, 15 * 10 + 10, white);
+    }
+
+    if (get_affine_span_length()) {
+        draw_text(renderer, font, ui[11], 15, 15 * 11 + 10, green);
+    } else {
+        draw_text(renderer, font, ui[11], 15, 15 * 11 + 10, white);
+    }
+
+    if (clip_method == CLIP_FRUSTUM) {
+        draw_text(renderer, font, ui[12], 15, 15 * 12 + 10, green);
+    } else {
+        draw_text(renderer, font, ui[12], 15, 15 * 12 + 10, white);
+    }
+
+    if (clip_method == CLIP_GUARD_BAND) {
+        draw_text(renderer, font, ui[13], 15, 15 * 13 + 10, green);
+    } else {
+        draw_text(renderer, font, ui[13], 15, 15 * 13 + 10, white);
+    }
+
+    if (pipeline_method == PIPELINE_SERIAL) {
+        draw_text(renderer, font, ui[14], 15, 15 * 14 + 10, green);
+    } else {
+        draw_text(renderer, font, ui[14], 15, 15 * 14 + 10, white);
+    }
+
+    if (pipeline_method == PIPELINE_OVERLAPPED) {
+        draw_text(renderer, font, ui[15], 15, 15 * 15 + 10, green);
+    } else {
+        draw_text(renderer, font, ui[15], 15, 15 * 15 + 10, white);
+    }
+
+    for (size_t i = 16; i < UI_LEN; i++) {
         draw_text(renderer, font, ui[i], 15, 15 * i + 10, white);
     }
 
+    // Pixels that passed the depth test and were shaded vs. covered pixels whose shading the depth test skipped
+    char stats[5][48] = { 0 };
+    snprintf(stats[0], sizeof(stats[0]), "shaded px: %d", raster_stats.pixels_shaded);
+    snprintf(
+        stats[1], sizeof(stats[1]), "depth rejected px: %d of %d",
+        raster_stats.pixels_rejected, raster_stats.pixels_shaded + raster_stats.pixels_rejected
+    );
+    snprintf(stats[2], sizeof(stats[2]), "hi-z rejected blocks: %d", raster_stats.blocks_rejected);
+
+    // Shading saved by the sort, the latest sorted frame against the latest unsorted one
+    if (sorted_pixels_shaded >= 0 && unsorted_pixels_shaded > 0) {
+        const int saved = unsorted_pixels_shaded - sorted_pixels_shaded;
+        snprintf(
+            stats[3], sizeof(stats[3]), "sort saved px: %d (%.0f%%)",
+            saved, 100.0f * saved / unsorted_pixels_shaded
+        );
+    } else {
+        snprintf(stats[3], sizeof(stats[3]), "sort saved px: <o>/<u> to compare");
+    }
+
+    if (get_affine_span_length()) {
+        // Bound on how far any affine span this frame was from the perspective-correct texel
+        snprintf(
+            stats[4], sizeof(stats[4]), "affine %d px err: %.2f texels",
+            get_affine_span_length(), raster_stats.max_affine_error
+        );
+    } else {
+        snprintf(stats[4], sizeof(stats[4]), "affine off");
+    }
+    for (size_t i = 0; i < 5; i++) {
+        draw_text(renderer, font, stats[i], win_width - 260, 15 * i + 10, white);
+    }
+
     TTF_CloseFont(font);
 }
 
@@ -359,8 +577,8 @@ void draw_text(
 
 void cleanup(void)
 {
-    free(colour_buf);
-    free(zbuf);
+    free_framebuffer(framebuffer);
+    free(vis_buf);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_Quit();
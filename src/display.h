@@ -3,6 +3,7 @@
 
 #include "SDL.h"
 #include "SDL_ttf.h"
+#include "framebuffer.h"
 #include "triangle.h"
 #include "vector.h"
 #include <stdbool.h>
@@ -16,6 +17,21 @@ enum cull_method {
     CULL_BACKFACE
 };
 
+enum sort_method {
+    SORT_NONE,
+    SORT_FRONT_TO_BACK
+};
+
+enum clip_method {
+    CLIP_FRUSTUM,
+    CLIP_GUARD_BAND
+};
+
+enum pipeline_method {
+    PIPELINE_SERIAL,
+    PIPELINE_OVERLAPPED
+};
+
 enum render_method {
     RENDER_WIRE,
     RENDER_WIRE_VERTEX,
@@ -23,6 +39,7 @@ enum render_method {
     RENDER_FILL_TRIANGLE_WIRE,
     RENDER_TEXTURED,
     RENDER_TEXTURED_WIRE,
+    RENDER_TEXTURED_VISIBILITY,
 };
 
 int get_win_width(void);
@@ -30,25 +47,31 @@ int get_win_height(void);
 
 void set_render_method(const int rm);
 void set_cull_method(const int cm);
+void set_sort_method(const int sm);
+void set_clip_method(const int cm);
+void set_pipeline_method(const int pm);
+void set_raster_stats(const raster_stats_t stats, const bool sorted);
 
 bool should_cull_backface(void);
+bool should_sort_front_to_back(void);
+bool should_clip_guard_band(void);
+bool should_pipeline_frames(void);
 bool should_render_filled_triangles(void);
 bool should_render_texture_triangles(void);
+bool should_render_visibility_buffer(void);
 bool should_render_wireframe_triangles(void);
 bool should_render_vertices(void);
 
 bool init_win(const bool debug);
-void clear_colour_buf(const uint32_t colour);
-void clear_zbuf(void);
-float get_zbuf_at(const int x, const int y);
-void update_zbuf_at(const int x, const int y, float value);
+void draw_background(void);
+framebuffer_t *get_framebuffer(void);
+uint32_t *get_vis_buf(void);
 void render_display(void);
 void render_colour_buf(void);
 
 void draw_pixel(const int x, const int y, const uint32_t colour);
-void draw_line(const int x0, const int y0, const int x1, const int y1, const uint32_t colour);
+void draw_line(int x0, int y0, int x1, int y1, const uint32_t colour);
 void draw_rect(const int x, const int y, const int w, const int h, const uint32_t colour);
-void draw_grid(void);
 void draw_text(SDL_Renderer *renderer, TTF_Font *font, const char *text, const int x, const int y, SDL_Color colour);
 void render_ui(SDL_Renderer *renderer);
 
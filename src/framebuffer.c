@@ -0,0 +1,141 @@
+#include "framebuffer.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#define HAVE_STREAMING_STORES
+#include <emmintrin.h>
+#endif
+
+#define FRAMEBUFFER_ALIGNMENT 64
+
+_Static_assert(sizeof(framebuffer_row_t) == FRAMEBUFFER_ALIGNMENT, "a tile row must fill exactly one cache line");
+
+framebuffer_t *create_framebuffer(const int width, const int height)
+{
+    framebuffer_t *framebuffer = (framebuffer_t *)calloc(1, sizeof(framebuffer_t));
+    if (!framebuffer) {
+        fprintf(stderr, "error allocating framebuffer\n");
+        return NULL;
+    }
+
+    framebuffer->width = width;
+    framebuffer->height = height;
+    framebuffer->tiles_x = (width + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+    framebuffer->tiles_y = (height + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+
+    const size_t num_tiles = (size_t)framebuffer->tiles_x * framebuffer->tiles_y;
+    framebuffer->rows = (framebuffer_row_t *)aligned_alloc(
+        FRAMEBUFFER_ALIGNMENT, sizeof(framebuffer_row_t) * FRAMEBUFFER_TILE_SIZE * num_tiles
+    );
+    framebuffer->tile_far = (float *)calloc(num_tiles, sizeof(float));
+    if (!framebuffer->rows || !framebuffer->tile_far) {
+        fprintf(stderr, "error allocating framebuffer\n");
+        free_framebuffer(framebuffer);
+        return NULL;
+    }
+
+    // Padding past the right and bottom edges is never drawn to, give it the nearest possible depth so that it
+    // never holds back the farthest depth of its tile
+    for (int y = 0; y < framebuffer->tiles_y * FRAMEBUFFER_TILE_SIZE; y++) {
+        for (int x = 0; x < framebuffer->tiles_x * FRAMEBUFFER_TILE_SIZE; x++) {
+            framebuffer_row_t *row = get_framebuffer_row(framebuffer, x, y);
+            const bool padding = x >= width || y >= height;
+            row->colour[x % FRAMEBUFFER_TILE_SIZE] = 0;
+            row->depth[x % FRAMEBUFFER_TILE_SIZE] = padding ? FLT_MAX : 0;
+        }
+    }
+
+    return framebuffer;
+}
+
+void free_framebuffer(framebuffer_t *framebuffer)
+{
+    if (!framebuffer) {
+        return;
+    }
+    free(framebuffer->rows);
+    free(framebuffer->tile_far);
+    free(framebuffer);
+}
+
+/*
+ * Fills every pixel with colour and nothing drawn, and the padding with the nearest possible depth as when it was
+ * created. The rows are written with non-temporal stores straight from registers, which write whole cache lines to
+ * memory without first reading them into the cache and evicting everything the rasteriser is about to need.
+ */
+void clear_framebuffer(framebuffer_t *framebuffer, const uint32_t colour)
+{
+    // The row every tile row is cleared to, and the rows that reach into the padding past the right and bottom edges
+    framebuffer_row_t inside, right_edge, padding;
+    for (int i = 0; i < FRAMEBUFFER_TILE_SIZE; i++) {
+        inside.colour[i] = right_edge.colour[i] = padding.colour[i] = colour;
+        inside.depth[i] = 0;
+        right_edge.depth[i] = i < framebuffer->width % FRAMEBUFFER_TILE_SIZE ? 0 : FLT_MAX;
+        padding.depth[i] = FLT_MAX;
+    }
+    if (framebuffer->width % FRAMEBUFFER_TILE_SIZE == 0) {
+        right_edge = inside;
+    }
+
+    for (int tile_y = 0; tile_y < framebuffer->tiles_y; tile_y++) {
+        for (int tile_x = 0; tile_x < framebuffer->tiles_x; tile_x++) {
+            const int tile = (tile_y * framebuffer->tiles_x) + tile_x;
+            framebuffer_row_t *rows = &framebuffer->rows[tile * FRAMEBUFFER_TILE_SIZE];
+            const framebuffer_row_t *fill = tile_x == framebuffer->tiles_x - 1 ? &right_edge : &inside;
+
+            for (int i = 0; i < FRAMEBUFFER_TILE_SIZE; i++) {
+                const bool below = (tile_y * FRAMEBUFFER_TILE_SIZE) + i >= framebuffer->height;
+                const framebuffer_row_t *row = below ? &padding : fill;
+#ifdef HAVE_STREAMING_STORES
+                const __m128i *in = (const __m128i *)row;
+                __m128i *out = (__m128i *)&rows[i];
+                _mm_stream_si128(&out[0], _mm_loadu_si128(&in[0]));
+                _mm_stream_si128(&out[1], _mm_loadu_si128(&in[1]));
+                _mm_stream_si128(&out[2], _mm_loadu_si128(&in[2]));
+                _mm_stream_si128(&out[3], _mm_loadu_si128(&in[3]));
+#else
+                rows[i] = *row;
+#endif
+            }
+        }
+    }
+#ifdef HAVE_STREAMING_STORES
+    _mm_sfence();
+#endif
+
+    memset(framebuffer->tile_far, 0, sizeof(float) * framebuffer->tiles_x * framebuffer->tiles_y);
+}
+
+// Writes the colours out in linear order, e.g. to a locked streaming texture
+void resolve_framebuffer(const framebuffer_t *framebuffer, void *pixels, const int pitch)
+{
+    for (int y = 0; y < framebuffer->height; y++) {
+        uint32_t *out = (uint32_t *)((uint8_t *)pixels + ((size_t)pitch * y));
+
+        for (int x = 0; x < framebuffer->width; x += FRAMEBUFFER_TILE_SIZE) {
+            const framebuffer_row_t *row = get_framebuffer_row(framebuffer, x, y);
+            const int count = framebuffer->width - x < FRAMEBUFFER_TILE_SIZE ? framebuffer->width - x : FRAMEBUFFER_TILE_SIZE;
+            memcpy(out + x, row->colour, sizeof(uint32_t) * count);
+        }
+    }
+}
+
+// Recomputes the farthest depth of the tile holding (x, y) after it was drawn to
+void update_framebuffer_tile_far(framebuffer_t *framebuffer, const int x, const int y)
+{
+    const framebuffer_row_t *row = get_framebuffer_row(framebuffer, x, y - (y % FRAMEBUFFER_TILE_SIZE));
+
+    float far_reciprocal_w = FLT_MAX;
+    for (int i = 0; i < FRAMEBUFFER_TILE_SIZE; i++) {
+        for (int j = 0; j < FRAMEBUFFER_TILE_SIZE; j++) {
+            if (row[i].depth[j] < far_reciprocal_w) {
+                far_reciprocal_w = row[i].depth[j];
+            }
+        }
+    }
+
+    framebuffer->tile_far[((y / FRAMEBUFFER_TILE_SIZE) * framebuffer->tiles_x) + (x / FRAMEBUFFER_TILE_SIZE)] = far_reciprocal_w;
+}
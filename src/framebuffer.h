@@ -0,0 +1,47 @@
+#ifndef FRAMEBUFFER_H_
+#define FRAMEBUFFER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Side of the square tiles the framebuffer is stored in, a tile row of colour and depth is one cache line
+#define FRAMEBUFFER_TILE_SIZE 8
+
+typedef struct {
+	uint32_t colour[FRAMEBUFFER_TILE_SIZE];
+	float depth[FRAMEBUFFER_TILE_SIZE]; // 1/w of the nearest triangle, 0 where nothing was drawn
+} framebuffer_row_t;
+
+/*
+ * Render target stored tile by tile, FRAMEBUFFER_TILE_SIZE rows per tile and tiles in row-major order. Colour and
+ * depth of the same tile row sit in the same 64 byte aligned cache line, so the depth test and the colour write of
+ * a span touch a single line. The width and height are padded up to whole tiles.
+ */
+typedef struct {
+	int width;
+	int height;
+	int tiles_x;
+	int tiles_y;
+	framebuffer_row_t *rows;
+	float *tile_far; // smallest (farthest) 1/w in each tile
+} framebuffer_t;
+
+framebuffer_t *create_framebuffer(const int width, const int height);
+void free_framebuffer(framebuffer_t *framebuffer);
+void clear_framebuffer(framebuffer_t *framebuffer, const uint32_t colour);
+void resolve_framebuffer(const framebuffer_t *framebuffer, void *pixels, const int pitch);
+void update_framebuffer_tile_far(framebuffer_t *framebuffer, const int x, const int y);
+
+// Row of the tile holding (x, y), unchecked
+static inline framebuffer_row_t *get_framebuffer_row(const framebuffer_t *framebuffer, const int x, const int y)
+{
+    const int tile = ((y / FRAMEBUFFER_TILE_SIZE) * framebuffer->tiles_x) + (x / FRAMEBUFFER_TILE_SIZE);
+    return &framebuffer->rows[(tile * FRAMEBUFFER_TILE_SIZE) + (y % FRAMEBUFFER_TILE_SIZE)];
+}
+
+static inline float get_framebuffer_tile_far(const framebuffer_t *framebuffer, const int x, const int y)
+{
+    return framebuffer->tile_far[((y / FRAMEBUFFER_TILE_SIZE) * framebuffer->tiles_x) + (x / FRAMEBUFFER_TILE_SIZE)];
+}
+
+#endif // FRAMEBUFFER_H_
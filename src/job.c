@@ -0,0 +1,174 @@
+#include "SDL.h"
+#include "job.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Job pool
+ *
+ * run_jobs() publishes a batch of count items and then works on the batch itself alongside the worker threads
+ * until every item has been claimed, before waiting for the stragglers to finish. Each item is claimed by exactly
+ * one thread, so items that write to disjoint memory need no further locking. Several threads may submit batches
+ * at the same time; workers take items from the oldest batch first.
+ */
+
+#define MAX_JOB_THREADS 64
+
+typedef struct job_batch {
+    job_fn fn;
+    void *data;
+    int count;
+    int next;      // next item to be claimed
+    int remaining; // items that have not finished running
+    struct job_batch *next_batch;
+} job_batch_t;
+
+static SDL_Thread *threads[MAX_JOB_THREADS];
+static int num_threads = 1;
+static bool running = false;
+
+static SDL_mutex *lock = NULL;
+static SDL_cond *work_available = NULL;
+static SDL_cond *work_done = NULL;
+static job_batch_t *batches = NULL;
+
+// Claims the next item of a batch, must be called with lock held
+static int claim_job(job_batch_t *batch)
+{
+    const int idx = batch->next++;
+
+    // Unlink the batch once all of its items are claimed, its submitter still waits on remaining
+    if (batch->next == batch->count) {
+        job_batch_t **link = &batches;
+        while (*link != batch) {
+            link = &(*link)->next_batch;
+        }
+        *link = batch->next_batch;
+    }
+
+    return idx;
+}
+
+// Runs a claimed item, must be called with lock held
+static void run_job(job_batch_t *batch, const int idx)
+{
+    SDL_UnlockMutex(lock);
+    batch->fn(idx, batch->data);
+    SDL_LockMutex(lock);
+
+    if (--batch->remaining == 0) {
+        SDL_CondBroadcast(work_done);
+    }
+}
+
+static int worker_main(void *data)
+{
+    (void)data;
+
+    SDL_LockMutex(lock);
+    while (running) {
+        job_batch_t *batch = batches;
+        if (!batch) {
+            SDL_CondWait(work_available, lock);
+            continue;
+        }
+        run_job(batch, claim_job(batch));
+    }
+    SDL_UnlockMutex(lock);
+
+    return 0;
+}
+
+bool init_jobs(const int num_job_threads)
+{
+    num_threads = num_job_threads < 1 ? 1 : num_job_threads;
+    if (num_threads > MAX_JOB_THREADS) {
+        num_threads = MAX_JOB_THREADS;
+    }
+
+    lock = SDL_CreateMutex();
+    work_available = SDL_CreateCond();
+    work_done = SDL_CreateCond();
+    if (!lock || !work_available || !work_done) {
+        fprintf(stderr, "error creating job pool: %s\n", SDL_GetError());
+        return false;
+    }
+
+    running = true;
+
+    // The thread calling run_jobs() is a worker too
+    for (int i = 1; i < num_threads; i++) {
+        threads[i] = SDL_CreateThread(worker_main, "job worker", NULL);
+        if (!threads[i]) {
+            fprintf(stderr, "error creating job worker: %s\n", SDL_GetError());
+            num_threads = i;
+            break;
+        }
+    }
+
+    return true;
+}
+
+void run_jobs(const job_fn fn, const int count, void *data)
+{
+    if (count <= 0) {
+        return;
+    }
+
+    // Nothing to share the work with
+    if (num_threads == 1 || !lock) {
+        for (int i = 0; i < count; i++) {
+            fn(i, data);
+        }
+        return;
+    }
+
+    job_batch_t batch = {
+        .fn = fn,
+        .data = data,
+        .count = count,
+        .remaining = count,
+    };
+
+    SDL_LockMutex(lock);
+
+    job_batch_t **tail = &batches;
+    while (*tail) {
+        tail = &(*tail)->next_batch;
+    }
+    *tail = &batch;
+    SDL_CondBroadcast(work_available);
+
+    // Help out with this batch until all of its items are claimed
+    while (batch.next < batch.count) {
+        run_job(&batch, claim_job(&batch));
+    }
+
+    while (batch.remaining > 0) {
+        SDL_CondWait(work_done, lock);
+    }
+
+    SDL_UnlockMutex(lock);
+}
+
+void free_jobs(void)
+{
+    if (!lock) {
+        return;
+    }
+
+    SDL_LockMutex(lock);
+    running = false;
+    SDL_CondBroadcast(work_available);
+    SDL_UnlockMutex(lock);
+
+    for (int i = 1; i < num_threads; i++) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+
+    SDL_DestroyCond(work_done);
+    SDL_DestroyCond(work_available);
+    SDL_DestroyMutex(lock);
+    lock = NULL;
+    num_threads = 1;
+}
@@ -0,0 +1,13 @@
+#ifndef JOB_H_
+#define JOB_H_
+
+#include <stdbool.h>
+
+// Runs one item of a batch of jobs, idx is in [0, count)
+typedef void (*job_fn)(const int idx, void *data);
+
+bool init_jobs(const int num_threads);
+void run_jobs(const job_fn fn, const int count, void *data);
+void free_jobs(void);
+
+#endif // JOB_H_
@@ -1,19 +1,24 @@
 #include "SDL.h"
+#include "arena.h"
 #include "array.h"
 #include "camera.h"
 #include "clipping.h"
 #include "display.h"
+#include "job.h"
 #include "light.h"
 #include "matrix.h"
 #include "mesh.h"
+#include "queue.h"
+#include "span.h"
 #include "texture.h"
+#include "tile.h"
 #include "triangle.h"
-#include "upng.h"
 #include "vector.h"
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -22,15 +27,79 @@
 bool setup(void);
 void process_input(void);
 vec2_t project(const vec3_t point);
-void process_graphics_pipeline_stages(mesh_t *mesh);
+int process_graphics_pipeline_stages(mesh_t *mesh);
+void process_vertex_chunk(const int idx, void *data);
+void process_face_chunk(const int idx, void *data);
+bool init_geometry_thread(void);
+int run_geometry_thread(void *data);
 void update(void);
 void render(void);
 void free_resources(void);
 
-// Stores the 2D projected points to be drawn
-#define MAX_TRIANGLES_PER_MESH 10000
-triangle_t triangles_to_render[MAX_TRIANGLES_PER_MESH];
-int num_triangles_to_render = 0;
+#define FRAME_ARENA_SIZE (1 << 20)
+
+/*
+ * Everything the geometry stage produces for a frame and render() draws from, in the frame's arena, which is
+ * released all at once when the frame is next started. The settings the geometry stage reads are copied in when
+ * the frame is started, so input may change them while the frame is being built.
+ */
+typedef struct {
+    arena_t arena;
+    render_queue_t queue; // the triangles to be drawn
+    uint32_t *order;      // the order to draw them in
+    vec2_t *lines;        // end points of the mesh edges drawn as wireframe, two per line
+    int num_lines;
+    int dropped_faces; // faces left out of the queue when memory ran out, reported once per frame
+    bool cull_backface;
+    bool clip_guard_band;
+    bool sort_front_to_back;
+    bool wireframe;
+} frame_t;
+
+// One frame is drawn while the other is built when frames are pipelined
+#define NUM_FRAMES 2
+frame_t frames[NUM_FRAMES] = { 0 };
+frame_t *render_frame = NULL;
+
+// The geometry thread builds geometry_frame between the start and done semaphores, it is NULL when the thread is idle
+SDL_Thread *geometry_thread = NULL;
+SDL_sem *geometry_start = NULL;
+SDL_sem *geometry_done = NULL;
+frame_t *geometry_frame = NULL;
+bool geometry_running = false;
+
+void start_frame(frame_t *frame);
+void build_frame(frame_t *frame);
+
+// Vertices and faces of each mesh are processed in chunks of up to this many by the job threads
+#define VERTEX_CHUNK_SIZE 4096
+#define FACE_CHUNK_SIZE 2048
+#define FACE_CHUNK_ARENA_SIZE (64 << 10)
+
+_Static_assert(VERTEX_CHUNK_SIZE % VERTEX_BATCH_SIZE == 0, "vertex chunks must start on a batch");
+
+typedef struct {
+    mesh_t *mesh;
+    int first;
+    int count;
+} vertex_chunk_t;
+
+/*
+ * A range of a mesh's faces and the triangles they produce this frame. Each chunk queues its triangles in its own
+ * arena, so the job threads never share a queue, and the chunk queues are joined in chunk order afterwards.
+ */
+typedef struct {
+    mesh_t *mesh;
+    int first;
+    int count;
+    int dropped_faces; // faces at the end of the chunk left out when its queue could not grow
+    arena_t arena;
+    render_queue_t queue;
+} face_chunk_t;
+
+vertex_chunk_t *vertex_chunks = NULL;
+face_chunk_t *face_chunks = NULL; // kept between frames along with their arenas, only the first few may be in use
+int num_face_chunks = 0;
 
 bool running = false;
 int prev_frame_time = 0;
@@ -69,6 +138,20 @@ bool setup(void)
 {
     set_render_method(RENDER_TEXTURED);
     set_cull_method(CULL_BACKFACE);
+    set_sort_method(SORT_FRONT_TO_BACK);
+    set_clip_method(CLIP_GUARD_BAND);
+    set_pipeline_method(PIPELINE_SERIAL);
+
+    init_span_kernels();
+    init_vertex_kernels();
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        if (!init_arena(&frames[i].arena, FRAME_ARENA_SIZE)) {
+            return false;
+        }
+    }
+    if (!init_jobs(SDL_GetCPUCount()) || !init_tiles() || !init_geometry_thread()) {
+        return false;
+    }
 
     init_light((vec3_t) { 0, 0, 1 });
 
@@ -130,6 +213,10 @@ void process_input(void)
                 set_render_method(RENDER_TEXTURED_WIRE);
             } break;
 
+            case SDLK_7: {
+                set_render_method(RENDER_TEXTURED_VISIBILITY);
+            } break;
+
             case SDLK_c: {
                 set_cull_method(CULL_BACKFACE);
             } break;
@@ -138,6 +225,36 @@ void process_input(void)
                 set_cull_method(CULL_NONE);
             } break;
 
+            case SDLK_o: {
+                set_sort_method(SORT_FRONT_TO_BACK);
+            } break;
+
+            case SDLK_u: {
+                set_sort_method(SORT_NONE);
+            } break;
+
+            case SDLK_p: {
+                // Cycle through perspective-correct, 8 and 16 pixel affine spans
+                const int length = get_affine_span_length();
+                set_affine_span_length(length ? length * 2 : 8);
+            } break;
+
+            case SDLK_f: {
+                set_clip_method(CLIP_FRUSTUM);
+            } break;
+
+            case SDLK_g: {
+                set_clip_method(CLIP_GUARD_BAND);
+            } break;
+
+            case SDLK_k: {
+                set_pipeline_method(PIPELINE_SERIAL);
+            } break;
+
+            case SDLK_l: {
+                set_pipeline_method(PIPELINE_OVERLAPPED);
+            } break;
+
             case SDLK_w: {
                 camera_rotate_pitch(3.0 * delta_time);
             } break;
@@ -194,7 +311,8 @@ void process_input(void)
  *                        `--> | Screen space |  <-- ready to render
  *                             +--------------+
  */
-void process_graphics_pipeline_stages(mesh_t *mesh)
+// Returns the number of faces of the mesh that could not be given a chunk and are left out of the frame
+int process_graphics_pipeline_stages(mesh_t *mesh)
 {
     // Create view matrix looking
     vec3_t target = get_camera_lookat_target();
@@ -207,71 +325,170 @@ void process_graphics_pipeline_stages(mesh_t *mesh)
     mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh->rotation.y);
     mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh->rotation.z);
 
-    size_t num_faces = (size_t)array_length(mesh->faces);
-    for (size_t i = 0; i < num_faces; i++) {
-        face_t mesh_face = mesh->faces[i];
+    // Create a world matrix with scale/rotation/translation matrices
+    mat4_t world_matrix = mat4_identity();
 
-        // Triangle face vertices
-        vec3_t face_vertices[NUM_TRIANGLE_VERTICES] = {
-            mesh->vertices[mesh_face.a],
-            mesh->vertices[mesh_face.b],
-            mesh->vertices[mesh_face.c],
-        };
+    // Scale -> rotate -> translate
+    world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
+    world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
 
-        vec4_t transformed_vertices[NUM_TRIANGLE_VERTICES];
+    mesh->world_view = mat4_mul_mat4(view_matrix, world_matrix);
 
-        for (int j = 0; j < NUM_TRIANGLE_VERTICES; j++) {
-            vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
+    // Edges become visible as the unclipped faces that share them are drawn
+    memset(mesh->visible_edges, 0, array_length(mesh->visible_edges));
 
-            // Create a world matrix with scale/rotation/translation matrices
-            mat4_t world_matrix = mat4_identity();
+    // Meshes outside the frustum are skipped, the faces of meshes inside it never need clipping
+    mesh->frustum_test = test_mesh_in_frustum(mesh, mesh->world_view);
+    if (mesh->frustum_test == FRUSTUM_OUTSIDE) {
+        return 0;
+    }
 
-            // Scale -> rotate -> translate
-            world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-            world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+    // Back faces are culled in model space against the camera position there, before any of their vertices are
+    // fetched, a mirroring transform flips which side of a face is its front
+    const mat4_t model_from_camera = mat4_inverse_affine(mesh->world_view);
+    mesh->camera_model_pos = (vec3_t) {
+        model_from_camera.m[0][3], model_from_camera.m[1][3], model_from_camera.m[2][3]
+    };
+    mesh->winding = mat4_determinant_affine(mesh->world_view) < 0 ? -1 : 1;
+    mesh->normal_matrix = mat4_normal_matrix(mesh->world_view);
+
+    // Split the vertices, then the faces, into chunks for the job threads
+    const int num_vertices = mesh->model_vertices.count;
+    for (int first = 0; first < num_vertices; first += VERTEX_CHUNK_SIZE) {
+        const int count = num_vertices - first < VERTEX_CHUNK_SIZE ? num_vertices - first : VERTEX_CHUNK_SIZE;
+        array_push(vertex_chunks, ((vertex_chunk_t) { mesh, first, count }));
+    }
 
-            transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
+    const int num_faces = array_length(mesh->faces);
+    for (int first = 0; first < num_faces; first += FACE_CHUNK_SIZE) {
+        if (num_face_chunks == array_length(face_chunks)) {
+            face_chunk_t new_chunk = { 0 };
+            if (!init_arena(&new_chunk.arena, FACE_CHUNK_ARENA_SIZE)) {
+                return num_faces - first;
+            }
+            array_push(face_chunks, new_chunk);
+        }
+        face_chunk_t *chunk = &face_chunks[num_face_chunks++];
+        chunk->mesh = mesh;
+        chunk->first = first;
+        chunk->count = num_faces - first < FACE_CHUNK_SIZE ? num_faces - first : FACE_CHUNK_SIZE;
+    }
 
-            // Transform scene to camera space
-            transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
+    return 0;
+}
 
-            transformed_vertices[j] = transformed_vertex;
+// Transforms a chunk of vertices to camera and clip space once, however many faces share each vertex
+void process_vertex_chunk(const int idx, void *data)
+{
+    const frame_t *frame = (const frame_t *)data;
+    const vertex_chunk_t *chunk = &vertex_chunks[idx];
+    mesh_t *mesh = chunk->mesh;
+
+    transform_vertices(
+        &mesh->world_view, &proj_matrix, &mesh->model_vertices, &mesh->clip_vertices, chunk->first, chunk->count
+    );
+
+    // Meshes straddling the frustum find the planes each vertex is outside of once, faces that are entirely inside
+    // one plane need no clipping against it
+    if (mesh->frustum_test == FRUSTUM_INTERSECTING) {
+        get_clip_outcodes(&mesh->clip_vertices, mesh->clip_outcodes, chunk->first, chunk->count);
+    }
+
+    // The mesh's edges are drawn between the screen positions of its vertices
+    if (frame->wireframe) {
+        for (int i = chunk->first; i < chunk->first + chunk->count; i++) {
+            vec4_t projected_point = vec4_perspective_divide(get_vertex_soa(&mesh->clip_vertices, i));
+            projected_point.x *= get_win_width() / 2.0;
+            projected_point.y *= get_win_height() / 2.0;
+            projected_point.y *= -1;
+            projected_point.x += get_win_width() / 2.0;
+            projected_point.y += get_win_height() / 2.0;
+            mesh->screen_vertices[i] = (vec2_t) { projected_point.x, projected_point.y };
         }
+    }
+}
+
+// Culls, lights, clips and projects a chunk of faces into the chunk's own queue
+void process_face_chunk(const int idx, void *data)
+{
+    const frame_t *frame = (const frame_t *)data;
+    face_chunk_t *chunk = &face_chunks[idx];
+    mesh_t *mesh = chunk->mesh;
 
-        // Calculate triangle face normal
-        vec3_t face_normal = get_triangle_normal(transformed_vertices);
+    reset_arena(&chunk->arena);
+    clear_render_queue(&chunk->queue);
+    chunk->dropped_faces = 0;
 
-        if (should_cull_backface()) {
-            // Find vector between the triangle and the camera
-            vec3_t camera_ray = vec3_sub((vec3_t) { 0 }, vec3_from_vec4(transformed_vertices[0]));
+    // A face queues a single triangle unless it is clipped, so the queue only grows for chunks with many clipped
+    // faces, and should this fail the first push tries again and reports the failure
+    reserve_render_queue(&chunk->queue, &chunk->arena, chunk->count);
 
-            // Calculate the dot product between the camera and triangle normal
-            float dot_normal_camera = vec3_dot(face_normal, camera_ray);
+    for (int i = chunk->first; i < chunk->first + chunk->count; i++) {
+        face_t mesh_face = mesh->faces[i];
+        mesh->visible_faces[i] = 0;
+
+        if (frame->cull_backface) {
+            // Find vector between the triangle and the camera
+            vec3_t camera_ray = vec3_sub(mesh->camera_model_pos, mesh->vertices[mesh_face.a]);
 
             // Cull if face is facing away from camera
-            if (dot_normal_camera < 0) {
+            if (mesh->winding * vec3_dot(mesh_face.normal, camera_ray) < 0) {
+                continue;
+            }
+        }
+
+        const int face_vertices[NUM_TRIANGLE_VERTICES] = { mesh_face.a, mesh_face.b, mesh_face.c };
+
+        // Faces entirely outside any one plane are rejected, the rest are clipped against the planes they cross
+        uint16_t clip_planes = 0;
+        if (mesh->frustum_test == FRUSTUM_INTERSECTING) {
+            const uint16_t outcode_a = mesh->clip_outcodes[mesh_face.a];
+            const uint16_t outcode_b = mesh->clip_outcodes[mesh_face.b];
+            const uint16_t outcode_c = mesh->clip_outcodes[mesh_face.c];
+            if (outcode_a & outcode_b & outcode_c) {
                 continue;
             }
+            clip_planes = (outcode_a | outcode_b | outcode_c)
+                & (frame->clip_guard_band ? GUARD_BAND_CLIP_PLANES : FRUSTUM_CLIP_PLANES);
         }
+        const bool clipped = clip_planes != 0;
 
-        // Create polygon from original triangle to be clipped
-        polygon_t polygon = poly_from_triangle(
-            vec3_from_vec4(transformed_vertices[0]),
-            vec3_from_vec4(transformed_vertices[1]),
-            vec3_from_vec4(transformed_vertices[2]),
-            mesh_face.a_uv,
-            mesh_face.b_uv,
-            mesh_face.c_uv
-        );
+        // Face normal in camera space for lighting
+        vec3_t face_normal = vec3_from_vec4(mat4_mul_vec4(mesh->normal_matrix, vec4_from_vec3(mesh_face.normal)));
+        vec3_normalise(&face_normal);
 
-        clip_polygon(&polygon);
+        // Calculate light intensity based on face normal relation to light direction, once for all the triangles
+        // clipping splits the face into
+        float light_intensity_factor = -vec3_dot(face_normal, get_light_direction());
+        mesh_face.colour = light_apply_intensity(mesh_face.colour, light_intensity_factor);
 
-        // Break clipped polygon back into triangles
         triangle_t triangles[MAX_TRIANGLES_PER_POLY] = { 0 };
-        int num_triangles = triangles_from_poly(&polygon, triangles);
+        int num_triangles = 1;
+
+        if (!clipped) {
+            // Only the texture coordinates are needed, unclipped faces project their clip space vertices
+            triangles[0].texcoords[0] = mesh_face.a_uv;
+            triangles[0].texcoords[1] = mesh_face.b_uv;
+            triangles[0].texcoords[2] = mesh_face.c_uv;
+        } else {
+            // Clip the triangle in clip space against the planes it straddles
+            polygon_t polygon = poly_from_triangle(
+                get_vertex_soa(&mesh->clip_vertices, mesh_face.a),
+                get_vertex_soa(&mesh->clip_vertices, mesh_face.b),
+                get_vertex_soa(&mesh->clip_vertices, mesh_face.c),
+                mesh_face.a_uv,
+                mesh_face.b_uv,
+                mesh_face.c_uv
+            );
+            polygon_t scratch;
+            const polygon_t *clipped_polygon = clip_polygon(&polygon, &scratch, clip_planes);
+
+            // Break clipped polygon back into triangles
+            num_triangles = triangles_from_poly(clipped_polygon, triangles);
+        }
 
         for (int t = 0; t < num_triangles; t++) {
             triangle_t triangle = triangles[t];
@@ -281,8 +498,12 @@ void process_graphics_pipeline_stages(mesh_t *mesh)
 
             // Loop all three vertices to perform projection
             for (int j = 0; j < NUM_TRIANGLE_VERTICES; j++) {
-                // Project current point to a 2D vector to draw
-                projected_points[j] = mat4_mul_vec4_project(proj_matrix, triangle.points[j]);
+                // Project current point to a 2D vector to draw, unclipped faces use their mesh's clip space vertices
+                if (clipped) {
+                    projected_points[j] = vec4_perspective_divide(triangle.points[j]);
+                } else {
+                    projected_points[j] = vec4_perspective_divide(get_vertex_soa(&mesh->clip_vertices, face_vertices[j]));
+                }
 
                 // Perform perspective divide
                 // if (projected_points[j].w != 0) {
@@ -303,44 +524,38 @@ void process_graphics_pipeline_stages(mesh_t *mesh)
                 projected_points[j].y += get_win_height() / 2.0;
             }
 
-            // Calculate light intensity based on face normal relation to light direction
-            float light_intensity_factor = -vec3_dot(face_normal, get_light_direction());
-            mesh_face.colour = light_apply_intensity(mesh_face.colour, light_intensity_factor);
-
-            triangle_t triangle_to_render = {
-                .points = {
-                    { projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w },
-                    { projected_points[1].x, projected_points[1].y, projected_points[1].z, projected_points[1].w },
-                    { projected_points[2].x, projected_points[2].y, projected_points[2].z, projected_points[2].w },
-                },
-                .texcoords = {
-                    { triangle.texcoords[0].u, triangle.texcoords[0].v },
-                    { triangle.texcoords[1].u, triangle.texcoords[1].v },
-                    { triangle.texcoords[2].u, triangle.texcoords[2].v },
-                },
-                .colour = mesh_face.colour,
-                .texture = mesh->texture
-            };
-
-            if (num_triangles_to_render < MAX_TRIANGLES_PER_MESH) {
-                triangles_to_render[num_triangles_to_render++] = triangle_to_render;
+            if (!push_render_triangle(
+                    &chunk->queue, &chunk->arena,
+                    projected_points, triangle.texcoords, mesh_face.colour, mesh->material, clipped
+                )) {
+                // The rest of the chunk is left out, none of its faces may mark edges with last frame's visibility
+                chunk->dropped_faces = chunk->first + chunk->count - i;
+                memset(&mesh->visible_faces[i], 0, chunk->dropped_faces);
+                return;
             }
         }
+
+        // An unclipped face is its own single triangle, its edges are drawn from the mesh's edge list
+        mesh->visible_faces[i] = !clipped;
     }
 }
 
-void update(void)
+// Snapshots the settings into the frame and sets up each mesh for the geometry stage, on the main thread
+void start_frame(frame_t *frame)
 {
-    int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - prev_frame_time);
-    if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
-        SDL_Delay(time_to_wait);
-    }
-
-    delta_time = (SDL_GetTicks() - prev_frame_time) / 1000.0;
-    prev_frame_time = SDL_GetTicks();
-
-    // Initialize triangles to render counter for current frame
-    num_triangles_to_render = 0;
+    reset_arena(&frame->arena);
+    clear_render_queue(&frame->queue);
+    frame->order = NULL;
+    frame->lines = NULL;
+    frame->num_lines = 0;
+    frame->dropped_faces = 0;
+    frame->cull_backface = should_cull_backface();
+    frame->clip_guard_band = should_clip_guard_band();
+    frame->sort_front_to_back = should_sort_front_to_back();
+    frame->wireframe = should_render_wireframe_triangles();
+
+    array_clear(vertex_chunks);
+    num_face_chunks = 0;
 
     for (int mesh_idx = 0; mesh_idx < get_num_meshes(); mesh_idx++) {
         mesh_t *mesh = get_mesh(mesh_idx);
@@ -351,52 +566,207 @@ void update(void)
         // mesh->rotation.z += 0.6 * delta_time;
         // mesh->translation.z = 5.0;
 
-        process_graphics_pipeline_stages(mesh);
+        frame->dropped_faces += process_graphics_pipeline_stages(mesh);
+    }
+}
+
+// Runs the geometry stage of a started frame on the job threads, from whichever thread builds the frame
+void build_frame(frame_t *frame)
+{
+    // Every vertex is transformed before any face reads it, then each chunk of faces fills its own queue
+    run_jobs(process_vertex_chunk, array_length(vertex_chunks), frame);
+    run_jobs(process_face_chunk, num_face_chunks, frame);
+
+    // Join the chunk queues in chunk order, so the frame's triangles are the same whichever thread ran each chunk
+    int num_triangles = 0;
+    for (int i = 0; i < num_face_chunks; i++) {
+        num_triangles += face_chunks[i].queue.count;
+        frame->dropped_faces += face_chunks[i].dropped_faces;
+    }
+    if (reserve_render_queue(&frame->queue, &frame->arena, num_triangles)) {
+        for (int i = 0; i < num_face_chunks; i++) {
+            append_render_queue(&frame->queue, &frame->arena, &face_chunks[i].queue);
+        }
+    } else {
+        fprintf(stderr, "error allocating the frame's render queue, dropped %d triangles\n", num_triangles);
+    }
+    if (frame->dropped_faces > 0) {
+        fprintf(stderr, "error allocating geometry, dropped %d faces this frame\n", frame->dropped_faces);
+    }
+
+    // The edges of the faces drawn unclipped are marked once the chunks are done, as edges are shared across
+    // chunks, then copied out as lines so that drawing the frame never reads the meshes
+    if (frame->wireframe) {
+        for (int i = 0; i < num_face_chunks; i++) {
+            const face_chunk_t *chunk = &face_chunks[i];
+            mesh_t *mesh = chunk->mesh;
+            for (int f = chunk->first; f < chunk->first + chunk->count; f++) {
+                if (mesh->visible_faces[f]) {
+                    mesh->visible_edges[mesh->faces[f].edges[0]] = 1;
+                    mesh->visible_edges[mesh->faces[f].edges[1]] = 1;
+                    mesh->visible_edges[mesh->faces[f].edges[2]] = 1;
+                }
+            }
+        }
+
+        int num_lines = 0;
+        for (int mesh_idx = 0; mesh_idx < get_num_meshes(); mesh_idx++) {
+            const mesh_t *mesh = get_mesh(mesh_idx);
+            for (int i = 0; i < array_length(mesh->edges); i++) {
+                num_lines += mesh->visible_edges[i];
+            }
+        }
+
+        frame->lines = (vec2_t *)arena_alloc(&frame->arena, sizeof(vec2_t) * 2 * num_lines);
+        for (int mesh_idx = 0; frame->lines && mesh_idx < get_num_meshes(); mesh_idx++) {
+            const mesh_t *mesh = get_mesh(mesh_idx);
+            for (int i = 0; i < array_length(mesh->edges); i++) {
+                if (mesh->visible_edges[i]) {
+                    frame->lines[frame->num_lines * 2] = mesh->screen_vertices[mesh->edges[i].a];
+                    frame->lines[frame->num_lines * 2 + 1] = mesh->screen_vertices[mesh->edges[i].b];
+                    frame->num_lines++;
+                }
+            }
+        }
+    }
+
+    // Draw the nearest triangles first so the depth test rejects as much as possible, otherwise in queue order
+    frame->order = (uint32_t *)arena_alloc(&frame->arena, sizeof(uint32_t) * frame->queue.count);
+    uint32_t *scratch = (uint32_t *)arena_alloc(&frame->arena, sizeof(uint32_t) * frame->queue.count);
+    if (!frame->order || !scratch) {
+        frame->queue.count = 0;
+    } else if (frame->sort_front_to_back) {
+        sort_render_queue_front_to_back(&frame->queue, frame->order, scratch);
+    } else {
+        for (int i = 0; i < frame->queue.count; i++) {
+            frame->order[i] = i;
+        }
+    }
+}
+
+bool init_geometry_thread(void)
+{
+    geometry_start = SDL_CreateSemaphore(0);
+    geometry_done = SDL_CreateSemaphore(0);
+    if (!geometry_start || !geometry_done) {
+        fprintf(stderr, "error creating geometry thread semaphores: %s\n", SDL_GetError());
+        return false;
+    }
+
+    geometry_running = true;
+    geometry_thread = SDL_CreateThread(run_geometry_thread, "geometry", NULL);
+    if (!geometry_thread) {
+        fprintf(stderr, "error creating geometry thread: %s\n", SDL_GetError());
+        geometry_running = false;
+        return false;
+    }
+
+    return true;
+}
+
+// Builds each frame it is handed while the main thread draws the previous one, the job threads serve both
+int run_geometry_thread(void *data)
+{
+    (void)data;
+
+    while (true) {
+        SDL_SemWait(geometry_start);
+        if (!geometry_running) {
+            break;
+        }
+        build_frame(geometry_frame);
+        SDL_SemPost(geometry_done);
+    }
+
+    return 0;
+}
+
+void update(void)
+{
+    int time_to_wait = FRAME_TARGET_TIME - (SDL_GetTicks() - prev_frame_time);
+    if (time_to_wait > 0 && time_to_wait <= FRAME_TARGET_TIME) {
+        SDL_Delay(time_to_wait);
+    }
+
+    delta_time = (SDL_GetTicks() - prev_frame_time) / 1000.0;
+    prev_frame_time = SDL_GetTicks();
+
+    if (geometry_frame) {
+        // The frame built on the geometry thread during the last render is drawn this time
+        SDL_SemWait(geometry_done);
+        render_frame = geometry_frame;
+        geometry_frame = NULL;
+    } else {
+        // Nothing was built ahead, build this frame now in the frame that was not drawn last
+        render_frame = render_frame == &frames[0] ? &frames[1] : &frames[0];
+        start_frame(render_frame);
+        build_frame(render_frame);
+    }
+
+    // Pipelined frames build the next frame in the other buffer while this one is drawn, which overlaps the
+    // geometry stage with rasterisation at the cost of input reaching the screen a frame later
+    if (should_pipeline_frames()) {
+        geometry_frame = render_frame == &frames[0] ? &frames[1] : &frames[0];
+        start_frame(geometry_frame);
+        SDL_SemPost(geometry_start);
     }
 }
 
 void render(void)
 {
-    clear_colour_buf(0xFF000000);
-    clear_zbuf();
+    draw_background();
 
-    draw_grid();
+    // Bin filled and textured triangles into screen tiles and rasterise the tiles in parallel
+    clear_tiles();
 
-    for (size_t i = 0; i < (size_t)num_triangles_to_render; i++) {
-        triangle_t triangle = triangles_to_render[i];
+    const render_queue_t *queue = &render_frame->queue;
+    for (int i = 0; i < queue->count; i++) {
+        const int idx = render_frame->order[i];
+        raster_setup_t setup;
 
-        if (should_render_filled_triangles()) {
-            draw_fill_triangle(
-                triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w,
-                triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w,
-                triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w,
-                triangle.colour
-            );
+        if (should_render_filled_triangles() && setup_fill_triangle(&setup, queue, idx)) {
+            bin_triangle(&setup);
         }
 
-        if (should_render_texture_triangles()) {
-            // TODO: way too many args - fix 🤮
-            draw_textured_triangle(
-                triangle.points[0].x, triangle.points[0].y, triangle.points[0].z, triangle.points[0].w, triangle.texcoords[0].u, triangle.texcoords[0].v,
-                triangle.points[1].x, triangle.points[1].y, triangle.points[1].z, triangle.points[1].w, triangle.texcoords[1].u, triangle.texcoords[1].v,
-                triangle.points[2].x, triangle.points[2].y, triangle.points[2].z, triangle.points[2].w, triangle.texcoords[2].u, triangle.texcoords[2].v,
-                triangle.texture
-            );
+        if ((should_render_texture_triangles() || should_render_visibility_buffer())
+            && setup_textured_triangle(&setup, queue, idx)) {
+            // Only rasterise depth and triangle ids, the tiles are textured once per pixel afterwards
+            if (should_render_visibility_buffer()) {
+                setup.shade_span = get_visibility_span_fn();
+            }
+            bin_triangle(&setup);
         }
+    }
+
+    render_tiles();
+    set_raster_stats(get_tile_stats(), render_frame->sort_front_to_back);
 
-        if (should_render_wireframe_triangles()) {
+    // Lines and vertices are drawn on top of the rasterised triangles, each edge shared by unclipped faces once. The
+    // wireframe follows the setting the frame was built with, its lines only exist if it was on at the time
+    if (render_frame->wireframe) {
+        for (int i = 0; i < render_frame->num_lines; i++) {
+            const vec2_t a = render_frame->lines[i * 2];
+            const vec2_t b = render_frame->lines[i * 2 + 1];
+            draw_line(a.x, a.y, b.x, b.y, 0xFF666666);
+        }
+    }
+
+    for (int i = 0; i < queue->count; i++) {
+        const int idx = render_frame->order[i];
+
+        if (render_frame->wireframe && queue->clipped[idx]) {
             draw_triangle(
-                triangle.points[0].x, triangle.points[0].y,
-                triangle.points[1].x, triangle.points[1].y,
-                triangle.points[2].x, triangle.points[2].y,
+                queue->x[0][idx], queue->y[0][idx],
+                queue->x[1][idx], queue->y[1][idx],
+                queue->x[2][idx], queue->y[2][idx],
                 0xFF666666
             );
         }
 
         if (should_render_vertices()) {
-            draw_rect(triangle.points[0].x, triangle.points[0].y, 3, 3, 0xFF0000FF);
-            draw_rect(triangle.points[1].x, triangle.points[1].y, 3, 3, 0xFF0000FF);
-            draw_rect(triangle.points[2].x, triangle.points[2].y, 3, 3, 0xFF0000FF);
+            draw_rect(queue->x[0][idx], queue->y[0][idx], 3, 3, 0xFF0000FF);
+            draw_rect(queue->x[1][idx], queue->y[1][idx], 3, 3, 0xFF0000FF);
+            draw_rect(queue->x[2][idx], queue->y[2][idx], 3, 3, 0xFF0000FF);
         }
     }
 
@@ -405,5 +775,29 @@ void render(void)
 
 void free_resources(void)
 {
+    // Let the geometry thread finish any frame it is building before it stops
+    if (geometry_frame) {
+        SDL_SemWait(geometry_done);
+        geometry_frame = NULL;
+    }
+    if (geometry_thread) {
+        geometry_running = false;
+        SDL_SemPost(geometry_start);
+        SDL_WaitThread(geometry_thread, NULL);
+        geometry_thread = NULL;
+    }
+    SDL_DestroySemaphore(geometry_start);
+    SDL_DestroySemaphore(geometry_done);
+
+    for (int i = 0; i < array_length(face_chunks); i++) {
+        free_arena(&face_chunks[i].arena);
+    }
+    array_free(face_chunks);
+    array_free(vertex_chunks);
+    free_tiles();
+    free_jobs();
     free_meshes();
+    for (int i = 0; i < NUM_FRAMES; i++) {
+        free_arena(&frames[i].arena);
+    }
 }
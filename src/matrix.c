@@ -158,16 +158,7 @@ mat4_t mat4_mul_mat4(const mat4_t m1, const mat4_t m2)
 
 vec4_t mat4_mul_vec4_project(const mat4_t mat4_proj, const vec4_t v)
 {
-    vec4_t result = mat4_mul_vec4(mat4_proj, v);
-
-    // Perform perspective divide with original z value stored in w
-    if (result.w != 0.0) {
-        result.x /= result.w;
-        result.y /= result.w;
-        result.z /= result.w;
-    }
-
-    return result;
+    return vec4_perspective_divide(mat4_mul_vec4(mat4_proj, v));
 }
 
 mat4_t mat4_look_at(const vec3_t eye, const vec3_t target, const vec3_t up)
@@ -183,3 +174,55 @@ mat4_t mat4_look_at(const vec3_t eye, const vec3_t target, const vec3_t up)
                         { z.x, z.y, z.z, -vec3_dot(z, eye) },
                         { 0, 0, 0, 1 } } };
 }
+
+// Determinant of the upper 3x3, negative when the matrix mirrors
+float mat4_determinant_affine(const mat4_t m)
+{
+    return m.m[0][0] * (m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1])
+        + m.m[0][1] * (m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2])
+        + m.m[0][2] * (m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0]);
+}
+
+/*
+ * Cofactor matrix of the upper 3x3, which is its inverse transpose scaled by the determinant. It takes normals
+ * (cross products of transformed edges) to the same space the matrix takes points to, with their direction kept
+ * even when the matrix mirrors, so they only need normalising afterwards.
+ */
+mat4_t mat4_normal_matrix(const mat4_t m)
+{
+    return (mat4_t) { { { m.m[1][1] * m.m[2][2] - m.m[1][2] * m.m[2][1],
+                          m.m[1][2] * m.m[2][0] - m.m[1][0] * m.m[2][2],
+                          m.m[1][0] * m.m[2][1] - m.m[1][1] * m.m[2][0],
+                          0 },
+                        { m.m[0][2] * m.m[2][1] - m.m[0][1] * m.m[2][2],
+                          m.m[0][0] * m.m[2][2] - m.m[0][2] * m.m[2][0],
+                          m.m[0][1] * m.m[2][0] - m.m[0][0] * m.m[2][1],
+                          0 },
+                        { m.m[0][1] * m.m[1][2] - m.m[0][2] * m.m[1][1],
+                          m.m[0][2] * m.m[1][0] - m.m[0][0] * m.m[1][2],
+                          m.m[0][0] * m.m[1][1] - m.m[0][1] * m.m[1][0],
+                          0 },
+                        { 0, 0, 0, 1 } } };
+}
+
+// Inverse of a matrix made of scales, rotations and translations only (bottom row 0 0 0 1)
+mat4_t mat4_inverse_affine(const mat4_t m)
+{
+    const mat4_t cofactors = mat4_normal_matrix(m);
+    const float inv_det = 1.0f / mat4_determinant_affine(m);
+
+    // The inverse of the 3x3 is its transposed cofactors over the determinant
+    mat4_t inverse = mat4_identity();
+    for (size_t i = 0; i < 3; i++) {
+        for (size_t j = 0; j < 3; j++) {
+            inverse.m[i][j] = cofactors.m[j][i] * inv_det;
+        }
+    }
+
+    // Undo the translation in the inverted frame
+    for (size_t i = 0; i < 3; i++) {
+        inverse.m[i][3] = -(inverse.m[i][0] * m.m[0][3] + inverse.m[i][1] * m.m[1][3] + inverse.m[i][2] * m.m[2][3]);
+    }
+
+    return inverse;
+}
@@ -18,5 +18,8 @@ vec4_t mat4_mul_vec4(const mat4_t m, const vec4_t v);
 mat4_t mat4_mul_mat4(const mat4_t m1, const mat4_t m2);
 vec4_t mat4_mul_vec4_project(const mat4_t mat4_proj, const vec4_t v);
 mat4_t mat4_look_at(const vec3_t eye, const vec3_t target, const vec3_t up);
+float mat4_determinant_affine(const mat4_t m);
+mat4_t mat4_normal_matrix(const mat4_t m);
+mat4_t mat4_inverse_affine(const mat4_t m);
 
 #endif // MATRIX_H_
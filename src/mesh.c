@@ -1,8 +1,12 @@
 #include "array.h"
+#include "clipping.h"
+#include "matrix.h"
 #include "mesh.h"
+#include "queue.h"
 #include "texture.h"
 #include "triangle.h"
 #include "vector.h"
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -39,19 +43,65 @@ void load_mesh(
 
 bool load_mesh_png_data(mesh_t *mesh, const char *filename)
 {
-    upng_t *png_image = upng_new_from_file(filename);
-    if (!png_image) {
-        fprintf(stderr, "error loading .png\n");
-        return false;
+    mesh->texture = load_png_texture(filename);
+    mesh->material = add_material(mesh->texture);
+    return mesh->texture != NULL;
+}
+
+typedef struct {
+    uint64_t key; // lower vertex index in the high bits
+    int face;
+    int slot;
+} face_edge_t;
+
+static int compare_face_edges(const void *a, const void *b)
+{
+    const uint64_t key_a = ((const face_edge_t *)a)->key;
+    const uint64_t key_b = ((const face_edge_t *)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+// Builds the list of unique edges of the mesh so that wireframes draw each shared edge once
+static bool build_mesh_edges(mesh_t *mesh)
+{
+    const int num_faces = array_length(mesh->faces);
+    if (num_faces == 0) {
+        return true;
     }
 
-    upng_decode(png_image);
-    if (upng_get_error(png_image) != UPNG_EOK) {
-        fprintf(stderr, "error decoding .png\n");
+    face_edge_t *face_edges = (face_edge_t *)malloc(sizeof(face_edge_t) * num_faces * 3);
+    if (!face_edges) {
+        fprintf(stderr, "error allocating mesh edges\n");
         return false;
     }
 
-    mesh->texture = png_image;
+    for (int i = 0; i < num_faces; i++) {
+        const int vertices[3] = { mesh->faces[i].a, mesh->faces[i].b, mesh->faces[i].c };
+        for (int slot = 0; slot < 3; slot++) {
+            const uint64_t a = vertices[slot];
+            const uint64_t b = vertices[(slot + 1) % 3];
+            face_edges[(i * 3) + slot] = (face_edge_t) {
+                .key = a < b ? (a << 32) | b : (b << 32) | a,
+                .face = i,
+                .slot = slot,
+            };
+        }
+    }
+
+    qsort(face_edges, num_faces * 3, sizeof(face_edge_t), compare_face_edges);
+
+    for (int i = 0; i < num_faces * 3; i++) {
+        if (i == 0 || face_edges[i].key != face_edges[i - 1].key) {
+            const edge_t edge = {
+                .a = (int)(face_edges[i].key >> 32),
+                .b = (int)(face_edges[i].key & 0xFFFFFFFF),
+            };
+            array_push(mesh->edges, edge);
+        }
+        mesh->faces[face_edges[i].face].edges[face_edges[i].slot] = array_length(mesh->edges) - 1;
+    }
+
+    free(face_edges);
 
     return true;
 }
@@ -110,6 +160,49 @@ bool load_mesh_obj_data(mesh_t *mesh, const char *filename)
     fclose(fp);
     free(line);
 
+    // Face normals only depend on the model, culling and lighting transform them as needed each frame
+    const int num_faces = array_length(mesh->faces);
+    for (int i = 0; i < num_faces; i++) {
+        face_t *face = &mesh->faces[i];
+        vec4_t vertices[NUM_TRIANGLE_VERTICES] = {
+            vec4_from_vec3(mesh->vertices[face->a]),
+            vec4_from_vec3(mesh->vertices[face->b]),
+            vec4_from_vec3(mesh->vertices[face->c]),
+        };
+        face->normal = get_triangle_normal(vertices);
+    }
+
+    const int num_vertices = array_length(mesh->vertices);
+    if (num_vertices > 0) {
+        mesh->bounds_min = mesh->vertices[0];
+        mesh->bounds_max = mesh->vertices[0];
+    }
+    for (int i = 1; i < num_vertices; i++) {
+        mesh->bounds_min.x = fminf(mesh->bounds_min.x, mesh->vertices[i].x);
+        mesh->bounds_min.y = fminf(mesh->bounds_min.y, mesh->vertices[i].y);
+        mesh->bounds_min.z = fminf(mesh->bounds_min.z, mesh->vertices[i].z);
+        mesh->bounds_max.x = fmaxf(mesh->bounds_max.x, mesh->vertices[i].x);
+        mesh->bounds_max.y = fmaxf(mesh->bounds_max.y, mesh->vertices[i].y);
+        mesh->bounds_max.z = fmaxf(mesh->bounds_max.z, mesh->vertices[i].z);
+    }
+    mesh->bounds_centre = vec3_mul(vec3_add(mesh->bounds_min, mesh->bounds_max), 0.5f);
+    mesh->bounds_radius = vec3_length(vec3_sub(mesh->bounds_max, mesh->bounds_centre));
+
+    if (!init_vertex_soa_from_vec3(&mesh->model_vertices, mesh->vertices, num_vertices)
+        || !init_vertex_soa(&mesh->clip_vertices, num_vertices)) {
+        return false;
+    }
+
+    if (!build_mesh_edges(mesh)) {
+        return false;
+    }
+
+    // Written every frame by the geometry stage, a mesh without faces still has its vertices transformed
+    mesh->screen_vertices = (vec2_t *)array_hold(NULL, num_vertices, sizeof(vec2_t));
+    mesh->clip_outcodes = (uint16_t *)array_hold(NULL, num_vertices, sizeof(uint16_t));
+    mesh->visible_faces = (uint8_t *)array_hold(NULL, array_length(mesh->faces), sizeof(uint8_t));
+    mesh->visible_edges = (uint8_t *)array_hold(NULL, array_length(mesh->edges), sizeof(uint8_t));
+
     return true;
 }
 
@@ -126,8 +219,47 @@ int get_num_meshes(void)
 void free_meshes(void)
 {
     for (int i = 0; i < mesh_count; i++) {
-        upng_free(meshes[i].texture);
+        free_texture(meshes[i].texture);
         array_free(meshes[i].faces);
         array_free(meshes[i].vertices);
+        array_free(meshes[i].edges);
+        free_vertex_soa(&meshes[i].model_vertices);
+        free_vertex_soa(&meshes[i].clip_vertices);
+        array_free(meshes[i].screen_vertices);
+        array_free(meshes[i].clip_outcodes);
+        array_free(meshes[i].visible_faces);
+        array_free(meshes[i].visible_edges);
+    }
+}
+
+/*
+ * Where the mesh lies relative to the frustum once transformed to camera space. The bounding sphere settles most
+ * meshes with one transform, only those it straddles a plane with transform the corners of the bounding box.
+ */
+frustum_test_t test_mesh_in_frustum(const mesh_t *mesh, const mat4_t world_view)
+{
+    // The sphere grows with the largest scale along any axis
+    float max_scale = 0;
+    for (int col = 0; col < 3; col++) {
+        const vec3_t axis = { world_view.m[0][col], world_view.m[1][col], world_view.m[2][col] };
+        max_scale = fmaxf(max_scale, vec3_length(axis));
+    }
+
+    const vec3_t centre = vec3_from_vec4(mat4_mul_vec4(world_view, vec4_from_vec3(mesh->bounds_centre)));
+    const frustum_test_t sphere_test = test_sphere_in_frustum(centre, mesh->bounds_radius * max_scale);
+    if (sphere_test != FRUSTUM_INTERSECTING) {
+        return sphere_test;
+    }
+
+    vec3_t corners[8];
+    for (int i = 0; i < 8; i++) {
+        const vec4_t corner = {
+            (i & 1) ? mesh->bounds_max.x : mesh->bounds_min.x,
+            (i & 2) ? mesh->bounds_max.y : mesh->bounds_min.y,
+            (i & 4) ? mesh->bounds_max.z : mesh->bounds_min.z,
+            1,
+        };
+        corners[i] = vec3_from_vec4(mat4_mul_vec4(world_view, corner));
     }
+    return test_points_in_frustum(corners, 8);
 }
@@ -1,15 +1,42 @@
 #ifndef MESH_H_
 #define MESH_H_
 
+#include "clipping.h"
+#include "matrix.h"
 #include "vector.h"
 #include "triangle.h"
-#include "upng.h"
+#include "texture.h"
+#include "vertex.h"
 #include <stdbool.h>
+#include <stdint.h>
+
+// An edge shared by one or more faces, a < b
+typedef struct {
+  int a;
+  int b;
+} edge_t;
 
 typedef struct {
   vec3_t *vertices;
   face_t *faces;
-  upng_t *texture;
+  edge_t *edges;
+  vertex_soa_t model_vertices;  // copy of vertices in streams for the batch transforms
+  vertex_soa_t clip_vertices;   // vertices transformed to clip space this frame, before the perspective divide
+  vec2_t *screen_vertices; // screen positions of clip_vertices, only meaningful for vertices in front of the camera
+  uint16_t *clip_outcodes; // frustum and guard band planes each of clip_vertices is outside of, one bit per plane
+  uint8_t *visible_faces;  // non-zero if the face was drawn unclipped this frame
+  uint8_t *visible_edges;  // non-zero if a face drawn unclipped this frame shares the edge
+  mat4_t world_view;           // this frame's model to camera space transform
+  mat4_t normal_matrix;        // face normals to camera space, up to scale
+  vec3_t camera_model_pos;     // camera position in model space for back face culling
+  float winding;               // -1 if world_view mirrors, which flips the front of every face
+  frustum_test_t frustum_test; // this frame's test of the bounds against the frustum
+  vec3_t bounds_min;    // model space bounding box
+  vec3_t bounds_max;
+  vec3_t bounds_centre; // model space bounding sphere, around the centre of the box
+  float bounds_radius;
+  texture_t *texture;
+  int material; // index of texture in the material table
   vec3_t rotation;
   vec3_t scale;
   vec3_t translation;
@@ -27,5 +54,6 @@ void load_mesh(
 int get_num_meshes(void);
 mesh_t *get_mesh(const int idx);
 void free_meshes(void);
+frustum_test_t test_mesh_in_frustum(const mesh_t *mesh, const mat4_t world_view);
 
 #endif // MESH_H_
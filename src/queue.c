@@ -0,0 +1,244 @@
+#include "arena.h"
+#include "queue.h"
+#include "texture.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// Capacity of the queue the first time a frame pushes to it, it doubles from there
+#define INITIAL_RENDER_QUEUE_CAPACITY 1024
+
+static texture_t *materials[MAX_MATERIALS];
+static int num_materials = 0;
+
+// Registers a texture in the material table, the index is what the render queue stores
+int add_material(texture_t *texture)
+{
+    if (num_materials == MAX_MATERIALS) {
+        fprintf(stderr, "error adding material, the table is full\n");
+        return -1;
+    }
+    materials[num_materials] = texture;
+    return num_materials++;
+}
+
+texture_t *get_material(const int material)
+{
+    return material >= 0 && material < num_materials ? materials[material] : NULL;
+}
+
+// The queue's streams live in the frame arena, so this must follow every reset of the arena
+void clear_render_queue(render_queue_t *queue)
+{
+    *queue = (render_queue_t) { 0 };
+}
+
+// Every stream of the queue, in the order they are laid out in its allocation
+#define RENDER_QUEUE_STREAMS(STREAM)                                                                           \
+    STREAM(x[0]) STREAM(x[1]) STREAM(x[2])                                                                     \
+    STREAM(y[0]) STREAM(y[1]) STREAM(y[2])                                                                     \
+    STREAM(reciprocal_w[0]) STREAM(reciprocal_w[1]) STREAM(reciprocal_w[2])                                    \
+    STREAM(u_over_w[0]) STREAM(u_over_w[1]) STREAM(u_over_w[2])                                                \
+    STREAM(v_over_w[0]) STREAM(v_over_w[1]) STREAM(v_over_w[2])                                                \
+    STREAM(colour) STREAM(material) STREAM(mip_level) STREAM(clipped) STREAM(depth_key)
+
+#define NUM_RENDER_QUEUE_STREAMS ((NUM_TRIANGLE_VERTICES * 5) + 5)
+
+_Static_assert(NUM_TRIANGLE_VERTICES == 3, "RENDER_QUEUE_STREAMS lists the vertex streams of a triangle");
+
+// Every stream starts on a cache line
+#define RENDER_QUEUE_STREAM_ALIGNMENT 64
+
+static size_t get_stream_size(const size_t item_size, const int capacity)
+{
+    return ((item_size * capacity) + RENDER_QUEUE_STREAM_ALIGNMENT - 1) & ~(size_t)(RENDER_QUEUE_STREAM_ALIGNMENT - 1);
+}
+
+/*
+ * The streams are carved one after the other out of a single allocation that starts with x[0], and grow together:
+ * the allocation is grown, in place when it is the arena's last, and each stream is then moved up to where it
+ * starts at the new capacity. Streams only move up, so moving the last one first never overwrites one that has yet
+ * to move.
+ */
+static bool resize_render_queue(render_queue_t *queue, arena_t *arena, const int capacity)
+{
+    size_t item_sizes[NUM_RENDER_QUEUE_STREAMS];
+    size_t old_offsets[NUM_RENDER_QUEUE_STREAMS];
+    size_t new_offsets[NUM_RENDER_QUEUE_STREAMS];
+    size_t old_size = 0;
+    size_t new_size = 0;
+    int num_streams = 0;
+
+#define LAY_OUT_STREAM(stream)                                                                                 \
+    item_sizes[num_streams] = sizeof(*queue->stream);                                                          \
+    old_offsets[num_streams] = old_size;                                                                       \
+    new_offsets[num_streams] = new_size;                                                                       \
+    old_size += get_stream_size(sizeof(*queue->stream), queue->capacity);                                      \
+    new_size += get_stream_size(sizeof(*queue->stream), capacity);                                             \
+    num_streams++;
+
+    RENDER_QUEUE_STREAMS(LAY_OUT_STREAM)
+
+#undef LAY_OUT_STREAM
+
+    unsigned char *streams = (unsigned char *)arena_grow(arena, queue->x[0], old_size, new_size);
+    if (!streams) {
+        return false;
+    }
+
+    for (int i = num_streams - 1; i >= 0; i--) {
+        memmove(streams + new_offsets[i], streams + old_offsets[i], item_sizes[i] * queue->count);
+    }
+
+    num_streams = 0;
+
+#define PLACE_STREAM(stream) queue->stream = (void *)(streams + new_offsets[num_streams++]);
+
+    RENDER_QUEUE_STREAMS(PLACE_STREAM)
+
+#undef PLACE_STREAM
+
+    queue->capacity = capacity;
+    return true;
+}
+
+// Makes room for at least capacity triangles in one step, rather than doubling as triangles are pushed
+bool reserve_render_queue(render_queue_t *queue, arena_t *arena, const int capacity)
+{
+    return capacity <= queue->capacity || resize_render_queue(queue, arena, capacity);
+}
+
+// Copies every triangle of src onto the end of the queue, in src's order
+bool append_render_queue(render_queue_t *queue, arena_t *arena, const render_queue_t *src)
+{
+    if (src->count == 0) {
+        return true;
+    }
+    if (!reserve_render_queue(queue, arena, queue->count + src->count)) {
+        return false;
+    }
+
+#define APPEND_STREAM(stream) \
+    memcpy(queue->stream + queue->count, src->stream, sizeof(*src->stream) * src->count)
+
+    for (int i = 0; i < NUM_TRIANGLE_VERTICES; i++) {
+        APPEND_STREAM(x[i]);
+        APPEND_STREAM(y[i]);
+        APPEND_STREAM(reciprocal_w[i]);
+        APPEND_STREAM(u_over_w[i]);
+        APPEND_STREAM(v_over_w[i]);
+    }
+    APPEND_STREAM(colour);
+    APPEND_STREAM(material);
+    APPEND_STREAM(mip_level);
+    APPEND_STREAM(clipped);
+    APPEND_STREAM(depth_key);
+
+#undef APPEND_STREAM
+
+    queue->count += src->count;
+    return true;
+}
+
+// Quantised distance to the nearest vertex of a triangle, smaller is closer to the camera
+static uint16_t get_depth_key(const vec4_t points[NUM_TRIANGLE_VERTICES])
+{
+    float w = fminf(fminf(points[0].w, points[1].w), points[2].w);
+    if (!(w > 0)) {
+        w = 0;
+    }
+
+    // The bits of a positive float sort in the same order as its value, keep the exponent and top of the mantissa
+    uint32_t bits;
+    memcpy(&bits, &w, sizeof(bits));
+    return bits >> 16;
+}
+
+/*
+ * Queues a triangle with its vertices in screen space (x and y in pixels, w from clip space) and its texture
+ * coordinates, growing the queue within the arena when it is full.
+ */
+bool push_render_triangle(
+    render_queue_t *queue,
+    arena_t *arena,
+    const vec4_t points[NUM_TRIANGLE_VERTICES],
+    const tex2_t texcoords[NUM_TRIANGLE_VERTICES],
+    const uint32_t colour,
+    const int material,
+    const bool clipped
+)
+{
+    if (queue->count == queue->capacity
+        && !resize_render_queue(queue, arena, queue->capacity ? queue->capacity * 2 : INITIAL_RENDER_QUEUE_CAPACITY)) {
+        return false;
+    }
+    const int idx = queue->count++;
+
+    for (int i = 0; i < NUM_TRIANGLE_VERTICES; i++) {
+        const float reciprocal_w = 1.0 / points[i].w;
+        const float flipped_v = 1.0 - texcoords[i].v;
+
+        queue->x[i][idx] = points[i].x;
+        queue->y[i][idx] = points[i].y;
+        queue->reciprocal_w[i][idx] = reciprocal_w;
+        queue->u_over_w[i][idx] = texcoords[i].u * reciprocal_w;
+        queue->v_over_w[i][idx] = flipped_v * reciprocal_w;
+    }
+
+    // Compare the area the triangle covers in the texture with the area it covers on screen to pick a mip level
+    int mip_level = 0;
+    const texture_t *texture = get_material(material);
+    if (texture) {
+        const tex2_t *t = texcoords;
+        const vec4_t *p = points;
+        const float texel_area = fabsf((t[1].u - t[0].u) * (t[2].v - t[0].v) - (t[2].u - t[0].u) * (t[1].v - t[0].v))
+            * texture->levels[0].width * texture->levels[0].height;
+        const float pixel_area = fabsf((p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y));
+        mip_level = get_mip_level(texture, texel_area, pixel_area);
+    }
+
+    queue->colour[idx] = colour;
+    queue->material[idx] = (uint16_t)material;
+    queue->mip_level[idx] = (uint8_t)mip_level;
+    queue->clipped[idx] = clipped;
+    queue->depth_key[idx] = get_depth_key(points);
+
+    return true;
+}
+
+/*
+ * Stable LSD radix sort of the queued triangles by depth key, one byte of the key per pass. Drawing the nearest
+ * triangles first lets the depth test (and the coarse z buffer) reject more of what is drawn behind them. Only
+ * indices move: order receives the queue indices nearest first, and scratch must hold as many indices.
+ */
+void sort_render_queue_front_to_back(const render_queue_t *queue, uint32_t *order, uint32_t *scratch)
+{
+    int offsets[256] = { 0 };
+
+    // The low byte scatters the triangles in queue order into scratch
+    for (int i = 0; i < queue->count; i++) {
+        offsets[queue->depth_key[i] & 0xFF]++;
+    }
+    for (int i = 0, offset = 0; i < 256; i++) {
+        const int count = offsets[i];
+        offsets[i] = offset;
+        offset += count;
+    }
+    for (int i = 0; i < queue->count; i++) {
+        scratch[offsets[queue->depth_key[i] & 0xFF]++] = i;
+    }
+
+    // The high byte scatters scratch into order
+    memset(offsets, 0, sizeof(offsets));
+    for (int i = 0; i < queue->count; i++) {
+        offsets[queue->depth_key[i] >> 8]++;
+    }
+    for (int i = 0, offset = 0; i < 256; i++) {
+        const int count = offsets[i];
+        offsets[i] = offset;
+        offset += count;
+    }
+    for (int i = 0; i < queue->count; i++) {
+        order[offsets[queue->depth_key[scratch[i]] >> 8]++] = scratch[i];
+    }
+}
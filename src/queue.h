@@ -0,0 +1,53 @@
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include "arena.h"
+#include "texture.h"
+#include "vector.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NUM_TRIANGLE_VERTICES 3
+
+// Textures are referred to by their index in the material table
+#define MAX_MATERIALS 256
+
+/*
+ * Triangles produced by the geometry stage for the rasteriser, stored as separate streams (structure of arrays)
+ * carved out of a single allocation in the frame arena. Everything the triangle setup needs per vertex is computed
+ * once when a triangle is queued: screen position, 1/w and the texture coordinates divided by w, with v flipped for
+ * the texture's row order.
+ */
+typedef struct {
+	float *x[NUM_TRIANGLE_VERTICES];
+	float *y[NUM_TRIANGLE_VERTICES];
+	float *reciprocal_w[NUM_TRIANGLE_VERTICES];
+	float *u_over_w[NUM_TRIANGLE_VERTICES];
+	float *v_over_w[NUM_TRIANGLE_VERTICES];
+	uint32_t *colour;
+	uint16_t *material;  // index into the material table
+	uint8_t *mip_level;  // level of the material's texture with texels closest to one per pixel
+	uint8_t *clipped;    // clipped triangles draw their own wireframe, the rest use their mesh's edges
+	uint16_t *depth_key; // quantised distance to the nearest vertex, smaller is closer to the camera
+	int count;
+	int capacity;
+} render_queue_t;
+
+int add_material(texture_t *texture);
+texture_t *get_material(const int material);
+
+void clear_render_queue(render_queue_t *queue);
+bool reserve_render_queue(render_queue_t *queue, arena_t *arena, const int capacity);
+bool append_render_queue(render_queue_t *queue, arena_t *arena, const render_queue_t *src);
+bool push_render_triangle(
+    render_queue_t *queue,
+    arena_t *arena,
+    const vec4_t points[NUM_TRIANGLE_VERTICES],
+    const tex2_t texcoords[NUM_TRIANGLE_VERTICES],
+    const uint32_t colour,
+    const int material,
+    const bool clipped
+);
+void sort_render_queue_front_to_back(const render_queue_t *queue, uint32_t *order, uint32_t *scratch);
+
+#endif // QUEUE_H_
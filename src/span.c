@@ -0,0 +1,665 @@
+#include "SDL_cpuinfo.h"
+#include "display.h"
+#include "span.h"
+#include "triangle.h"
+#include "texture.h"
+#include <stdbool.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * Span kernels
+ *
+ * Every kernel evaluates pixel i of a span as f + df/dx * i rather than accumulating df/dx, so the scalar and
+ * SIMD kernels perform exactly the same float operations per pixel and produce identical images.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_SPANS
+#include <immintrin.h>
+#endif
+
+// Pixels between exact texture coordinates in the affine spans, 0 for perspective-correct spans
+static int affine_span_length = 0;
+static float affine_span_step = 0;
+
+unsigned int shade_fill_span(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+)
+{
+    (void)stats;
+
+    framebuffer_row_t *row = get_framebuffer_row(get_framebuffer(), x, y);
+    unsigned int written = 0;
+
+    for (int i = 0; i < RASTER_BLOCK_SIZE; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+
+        const float reciprocal_w = attribs.reciprocal_w + setup->reciprocal_w.dfdx * i;
+
+        // Only draw pixel if it is closer to the camera than what was already in the depth buffer
+        if (reciprocal_w > row->depth[i]) {
+            row->colour[i] = setup->colour;
+            row->depth[i] = reciprocal_w;
+            written |= 1u << i;
+        }
+    }
+
+    return written;
+}
+
+static inline uint32_t fetch_texel(const mip_level_t *mip, const float u, const float v)
+{
+    // Map UV coords to texture width and height, wrapping with a mask as the sides are powers of two
+    const int tex_x = abs((int)(u * mip->width)) & (mip->width - 1);
+    const int tex_y = abs((int)(v * mip->height)) & (mip->height - 1);
+
+    return mip->texels[get_texel_index(mip, tex_x, tex_y)];
+}
+
+// Fetches the texel for pixel i of a span whose first pixel has the given attributes
+static inline uint32_t sample_texel(
+    const raster_attribs_t attribs,
+    const int i,
+    const float reciprocal_w,
+    const raster_setup_t *setup
+)
+{
+    // Divide the values back by 1/w to "reverse" the reciprocal calulation
+    const float u = (attribs.u_over_w + setup->u_over_w.dfdx * i) / reciprocal_w;
+    const float v = (attribs.v_over_w + setup->v_over_w.dfdx * i) / reciprocal_w;
+
+    return fetch_texel(setup->mip, u, v);
+}
+
+unsigned int shade_textured_span(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+)
+{
+    (void)stats;
+
+    framebuffer_row_t *row = get_framebuffer_row(get_framebuffer(), x, y);
+    unsigned int written = 0;
+
+    for (int i = 0; i < RASTER_BLOCK_SIZE; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+
+        const float reciprocal_w = attribs.reciprocal_w + setup->reciprocal_w.dfdx * i;
+
+        // Only fetch a texel if it is closer to the camera than what was already in the depth buffer
+        if (reciprocal_w > row->depth[i]) {
+            row->colour[i] = sample_texel(attribs, i, reciprocal_w, setup);
+            row->depth[i] = reciprocal_w;
+            written |= 1u << i;
+        }
+    }
+
+    return written;
+}
+
+/*
+ * Affine spans
+ *
+ * Exact u and v are only computed every affine_span_length pixels, at multiples of the length in screen space, and
+ * interpolated linearly in between. The length is a multiple of RASTER_BLOCK_SIZE so every span lies within a
+ * single segment, and neighbouring spans agree on the values at the segment ends they share. That costs 2 divides
+ * per span instead of 2 per pixel.
+ *
+ * Over a segment whose ends have 1/w of q0 and q1, the linear interpolation strays from the perspective-correct
+ * value by at most |delta| * (sqrt(k) - 1) / (sqrt(k) + 1) with k = max(q0, q1) / min(q0, q1), where delta is the
+ * change across the segment. That is below |delta| * |q0 - q1| / (4 * min(q0, q1)), which is what gets reported,
+ * in texels of the triangle's mip level.
+ */
+
+// Segment ends past a triangle's edges can get no farther than this times the farthest depth of the triangle
+#define AFFINE_MIN_RECIPROCAL_W_SCALE 0.5f
+
+// u and v at pixel i of a span are u + du * (t + i) and v + dv * (t + i)
+typedef struct {
+    float u, du;
+    float v, dv;
+    float t;
+} affine_span_t;
+
+/*
+ * Returns false if a segment end has 1/w too close to 0 (it lies far enough past the triangle's edges that the
+ * error would be large) and the span has to be shaded exactly.
+ */
+static inline bool get_affine_span(
+    const raster_attribs_t attribs,
+    const int x,
+    const raster_setup_t *setup,
+    affine_span_t *span,
+    float *max_error
+)
+{
+    const int length = affine_span_length;
+
+    // Segment ends relative to the first pixel of the span
+    const float dx0 = (x & ~(length - 1)) - x;
+    const float dx1 = dx0 + length;
+
+    const float reciprocal_w0 = attribs.reciprocal_w + setup->reciprocal_w.dfdx * dx0;
+    const float reciprocal_w1 = attribs.reciprocal_w + setup->reciprocal_w.dfdx * dx1;
+    const float min_reciprocal_w = setup->min_reciprocal_w * AFFINE_MIN_RECIPROCAL_W_SCALE;
+    if (!(reciprocal_w0 >= min_reciprocal_w && reciprocal_w1 >= min_reciprocal_w)) {
+        return false;
+    }
+
+    const float w0 = 1 / reciprocal_w0;
+    const float w1 = 1 / reciprocal_w1;
+    const float u0 = (attribs.u_over_w + setup->u_over_w.dfdx * dx0) * w0;
+    const float v0 = (attribs.v_over_w + setup->v_over_w.dfdx * dx0) * w0;
+    const float u1 = (attribs.u_over_w + setup->u_over_w.dfdx * dx1) * w1;
+    const float v1 = (attribs.v_over_w + setup->v_over_w.dfdx * dx1) * w1;
+
+    span->u = u0;
+    span->du = (u1 - u0) * affine_span_step;
+    span->v = v0;
+    span->dv = (v1 - v0) * affine_span_step;
+    span->t = -dx0;
+
+    const mip_level_t *mip = setup->mip;
+    const float texels = fmaxf(fabsf(u1 - u0) * mip->width, fabsf(v1 - v0) * mip->height);
+    const float error = texels * fabsf(reciprocal_w0 - reciprocal_w1) * 0.25f * fmaxf(w0, w1);
+    if (error > *max_error) {
+        *max_error = error;
+    }
+
+    return true;
+}
+
+static inline uint32_t sample_affine_texel(const affine_span_t *span, const int i, const mip_level_t *mip)
+{
+    const float t = span->t + i;
+    return fetch_texel(mip, span->u + span->du * t, span->v + span->dv * t);
+}
+
+unsigned int shade_affine_textured_span(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+)
+{
+    framebuffer_row_t *row = get_framebuffer_row(get_framebuffer(), x, y);
+    unsigned int pass = 0;
+
+    // Depth test first so that spans that are entirely hidden never divide
+    for (int i = 0; i < RASTER_BLOCK_SIZE; i++) {
+        const float reciprocal_w = attribs.reciprocal_w + setup->reciprocal_w.dfdx * i;
+        if ((mask & (1u << i)) && reciprocal_w > row->depth[i]) {
+            pass |= 1u << i;
+        }
+    }
+    if (!pass) {
+        return 0;
+    }
+
+    affine_span_t span;
+    if (!get_affine_span(attribs, x, setup, &span, &stats->max_affine_error)) {
+        return shade_textured_span(x, y, pass, attribs, setup, stats);
+    }
+
+    for (int i = 0; i < RASTER_BLOCK_SIZE; i++) {
+        if (pass & (1u << i)) {
+            row->colour[i] = sample_affine_texel(&span, i, setup->mip);
+            row->depth[i] = attribs.reciprocal_w + setup->reciprocal_w.dfdx * i;
+        }
+    }
+
+    return pass;
+}
+
+/*
+ * Visibility buffer
+ *
+ * RENDER_TEXTURED_VISIBILITY rasterises only depth and the id of the nearest triangle per pixel, then textures
+ * every covered pixel exactly once in resolve_visibility(), so the number of texel fetches no longer grows with
+ * overdraw. The attributes are rebuilt with get_span_attribs() and the same per-pixel maths as
+ * shade_textured_span(), so both modes draw the same image.
+ */
+unsigned int shade_visibility_span(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+)
+{
+    (void)stats;
+
+    const size_t offset = ((size_t)get_win_width() * y) + x;
+    uint32_t *vis_row = get_vis_buf() + offset;
+    framebuffer_row_t *row = get_framebuffer_row(get_framebuffer(), x, y);
+    unsigned int written = 0;
+
+    for (int i = 0; i < RASTER_BLOCK_SIZE; i++) {
+        if (!(mask & (1u << i))) {
+            continue;
+        }
+
+        const float reciprocal_w = attribs.reciprocal_w + setup->reciprocal_w.dfdx * i;
+
+        if (reciprocal_w > row->depth[i]) {
+            row->depth[i] = reciprocal_w;
+            vis_row[i] = setup->id;
+            written |= 1u << i;
+        }
+    }
+
+    return written;
+}
+
+static void resolve_visibility_scalar(
+    const raster_setup_t *setups,
+    const int min_x, const int min_y,
+    const int max_x, const int max_y,
+    raster_stats_t *stats
+)
+{
+    const int win_width = get_win_width();
+    const int end_x = max_x < win_width - 1 ? max_x : win_width - 1;
+    const int end_y = max_y < get_win_height() - 1 ? max_y : get_win_height() - 1;
+    framebuffer_t *framebuffer = get_framebuffer();
+    const uint32_t *vis_buf = get_vis_buf();
+
+    for (int y = min_y; y <= end_y; y++) {
+        for (int span_x = min_x; span_x <= end_x; span_x += RASTER_BLOCK_SIZE) {
+            framebuffer_row_t *row = get_framebuffer_row(framebuffer, span_x, y);
+
+            // Neighbouring pixels mostly belong to the same triangle, only rebuild the attributes when it changes
+            uint32_t id = UINT32_MAX;
+            raster_attribs_t attribs = { 0 };
+            bool affine = false;
+            affine_span_t span;
+
+            for (int x = span_x; x < span_x + RASTER_BLOCK_SIZE && x <= end_x; x++) {
+                const int i = x - span_x;
+
+                // Nothing was drawn here this frame
+                if (!(row->depth[i] > 0)) {
+                    continue;
+                }
+
+                const raster_setup_t *setup = &setups[vis_buf[((size_t)win_width * y) + x]];
+                if (setup->id != id) {
+                    id = setup->id;
+                    attribs = get_span_attribs(setup, span_x, y);
+                    affine = affine_span_length
+                        && get_affine_span(attribs, span_x, setup, &span, &stats->max_affine_error);
+                }
+
+                if (affine) {
+                    row->colour[i] = sample_affine_texel(&span, i, setup->mip);
+                } else {
+                    const float reciprocal_w = attribs.reciprocal_w + setup->reciprocal_w.dfdx * i;
+                    row->colour[i] = sample_texel(attribs, i, reciprocal_w, setup);
+                }
+            }
+        }
+    }
+}
+
+#ifdef HAVE_AVX2_SPANS
+static bool use_avx2 = false;
+
+// 8-wide morton_spread()
+__attribute__((target("avx2"))) static inline __m256i morton_spread_avx2(__m256i v)
+{
+    v = _mm256_and_si256(v, _mm256_set1_epi32(0x0000FFFF));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 8)), _mm256_set1_epi32(0x00FF00FF));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 4)), _mm256_set1_epi32(0x0F0F0F0F));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 2)), _mm256_set1_epi32(0x33333333));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 1)), _mm256_set1_epi32(0x55555555));
+    return v;
+}
+
+// 8-wide fetch_texel() for the lanes in pass
+__attribute__((target("avx2"))) static inline __m256i fetch_texels_avx2(
+    const mip_level_t *mip,
+    const __m256 u,
+    const __m256 v,
+    const __m256i pass
+)
+{
+    // Map UV coords to texture width and height, wrapping with a mask as the sides are powers of two
+    const __m256i tex_x = _mm256_and_si256(
+        _mm256_abs_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(u, _mm256_set1_ps(mip->width)))),
+        _mm256_set1_epi32(mip->width - 1)
+    );
+    const __m256i tex_y = _mm256_and_si256(
+        _mm256_abs_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(v, _mm256_set1_ps(mip->height)))),
+        _mm256_set1_epi32(mip->height - 1)
+    );
+
+    // Same as get_texel_index()
+    const __m256i square_mask = _mm256_set1_epi32((1 << mip->morton_bits) - 1);
+    const __m256i texel_idx = _mm256_or_si256(
+        _mm256_or_si256(
+            morton_spread_avx2(_mm256_and_si256(tex_x, square_mask)),
+            _mm256_slli_epi32(morton_spread_avx2(_mm256_and_si256(tex_y, square_mask)), 1)
+        ),
+        _mm256_sll_epi32(
+            _mm256_srl_epi32(_mm256_or_si256(tex_x, tex_y), _mm_cvtsi32_si128(mip->morton_bits)),
+            _mm_cvtsi32_si128(mip->morton_bits * 2)
+        )
+    );
+
+    return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)mip->texels, texel_idx, pass, 4);
+}
+
+/*
+ * 8-wide version of shade_textured_span. A span is exactly one framebuffer tile row, depth and colour are read and
+ * written with masked loads and stores so lanes outside of the triangle (or past the right edge of the screen) are
+ * never touched.
+ */
+__attribute__((target("avx2"))) static unsigned int shade_textured_span_avx2(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+)
+{
+    (void)stats;
+
+    const __m256 lane_index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i lane_bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i coverage = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), lane_bit), lane_bit);
+
+    framebuffer_row_t *row = get_framebuffer_row(get_framebuffer(), x, y);
+
+    const __m256 reciprocal_w = _mm256_add_ps(
+        _mm256_set1_ps(attribs.reciprocal_w),
+        _mm256_mul_ps(_mm256_set1_ps(setup->reciprocal_w.dfdx), lane_index)
+    );
+
+    // Only fetch texels for lanes that are closer to the camera than what was already in the depth buffer
+    const __m256 old_reciprocal_w = _mm256_maskload_ps(row->depth, coverage);
+    const __m256i pass = _mm256_and_si256(
+        coverage, _mm256_castps_si256(_mm256_cmp_ps(reciprocal_w, old_reciprocal_w, _CMP_GT_OQ))
+    );
+    if (_mm256_testz_si256(pass, pass)) {
+        return 0;
+    }
+
+    // Divide the values back by 1/w to "reverse" the reciprocal calulation
+    const __m256 u = _mm256_div_ps(
+        _mm256_add_ps(_mm256_set1_ps(attribs.u_over_w), _mm256_mul_ps(_mm256_set1_ps(setup->u_over_w.dfdx), lane_index)),
+        reciprocal_w
+    );
+    const __m256 v = _mm256_div_ps(
+        _mm256_add_ps(_mm256_set1_ps(attribs.v_over_w), _mm256_mul_ps(_mm256_set1_ps(setup->v_over_w.dfdx), lane_index)),
+        reciprocal_w
+    );
+
+    _mm256_maskstore_epi32((int *)row->colour, pass, fetch_texels_avx2(setup->mip, u, v, pass));
+    _mm256_maskstore_ps(row->depth, pass, reciprocal_w);
+
+    return _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+}
+
+// 8-wide u and v of a span with the same float operations as sample_texel() and sample_affine_texel()
+__attribute__((target("avx2"))) static inline void get_span_uv_avx2(
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    const affine_span_t *span,
+    __m256 *u,
+    __m256 *v
+)
+{
+    const __m256 lane_index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+
+    if (span) {
+        const __m256 t = _mm256_add_ps(_mm256_set1_ps(span->t), lane_index);
+        *u = _mm256_add_ps(_mm256_set1_ps(span->u), _mm256_mul_ps(_mm256_set1_ps(span->du), t));
+        *v = _mm256_add_ps(_mm256_set1_ps(span->v), _mm256_mul_ps(_mm256_set1_ps(span->dv), t));
+        return;
+    }
+
+    const __m256 reciprocal_w = _mm256_add_ps(
+        _mm256_set1_ps(attribs.reciprocal_w),
+        _mm256_mul_ps(_mm256_set1_ps(setup->reciprocal_w.dfdx), lane_index)
+    );
+    *u = _mm256_div_ps(
+        _mm256_add_ps(_mm256_set1_ps(attribs.u_over_w), _mm256_mul_ps(_mm256_set1_ps(setup->u_over_w.dfdx), lane_index)),
+        reciprocal_w
+    );
+    *v = _mm256_div_ps(
+        _mm256_add_ps(_mm256_set1_ps(attribs.v_over_w), _mm256_mul_ps(_mm256_set1_ps(setup->v_over_w.dfdx), lane_index)),
+        reciprocal_w
+    );
+}
+
+// 8-wide shade_visibility_span()
+__attribute__((target("avx2"))) static unsigned int shade_visibility_span_avx2(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+)
+{
+    (void)stats;
+
+    const __m256 lane_index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i lane_bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i coverage = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), lane_bit), lane_bit);
+
+    uint32_t *vis_row = get_vis_buf() + ((size_t)get_win_width() * y) + x;
+    framebuffer_row_t *row = get_framebuffer_row(get_framebuffer(), x, y);
+
+    const __m256 reciprocal_w = _mm256_add_ps(
+        _mm256_set1_ps(attribs.reciprocal_w),
+        _mm256_mul_ps(_mm256_set1_ps(setup->reciprocal_w.dfdx), lane_index)
+    );
+
+    const __m256 old_reciprocal_w = _mm256_maskload_ps(row->depth, coverage);
+    const __m256i pass = _mm256_and_si256(
+        coverage, _mm256_castps_si256(_mm256_cmp_ps(reciprocal_w, old_reciprocal_w, _CMP_GT_OQ))
+    );
+
+    // The visibility buffer is not tiled, so lanes past the right edge of the screen must not be touched
+    _mm256_maskstore_ps(row->depth, pass, reciprocal_w);
+    _mm256_maskstore_epi32((int *)vis_row, pass, _mm256_set1_epi32((int)setup->id));
+
+    return _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+}
+
+/*
+ * 8-wide resolve_visibility_scalar(). Each row of a tile is textured with one 8-wide evaluation per distinct
+ * triangle in it, usually just the one, with the lanes of the other triangles masked off.
+ */
+__attribute__((target("avx2"))) static void resolve_visibility_avx2(
+    const raster_setup_t *setups,
+    const int min_x, const int min_y,
+    const int max_x, const int max_y,
+    raster_stats_t *stats
+)
+{
+    const int win_width = get_win_width();
+    const int end_x = max_x < win_width - 1 ? max_x : win_width - 1;
+    const int end_y = max_y < get_win_height() - 1 ? max_y : get_win_height() - 1;
+    framebuffer_t *framebuffer = get_framebuffer();
+    const uint32_t *vis_buf = get_vis_buf();
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    // Column by column, so the rows of a block are contiguous in the framebuffer and a triangle that covers the
+    // row above only has its attributes stepped down a row rather than set up again
+    for (int span_x = min_x; span_x <= end_x; span_x += RASTER_BLOCK_SIZE) {
+        uint32_t last_id = UINT32_MAX;
+        int last_y = 0;
+        raster_attribs_t last_attribs = {0};
+
+        for (int y = min_y; y <= end_y; y++) {
+            framebuffer_row_t *row = get_framebuffer_row(framebuffer, span_x, y);
+            const uint32_t *vis_row = vis_buf + ((size_t)win_width * y) + span_x;
+
+            // Lanes on screen where something was drawn this frame
+            const __m256i on_screen = _mm256_cmpgt_epi32(_mm256_set1_epi32(end_x - span_x + 1), lane);
+            const __m256i drawn = _mm256_and_si256(
+                on_screen,
+                _mm256_castps_si256(_mm256_cmp_ps(_mm256_load_ps(row->depth), _mm256_setzero_ps(), _CMP_GT_OQ))
+            );
+
+            // Most rows of a tile are often empty, leave their part of the visibility buffer out of the cache
+            unsigned int remaining = _mm256_movemask_ps(_mm256_castsi256_ps(drawn));
+            if (!remaining) {
+                continue;
+            }
+
+            const __m256i ids = _mm256_maskload_epi32((const int *)vis_row, drawn);
+            while (remaining) {
+                const uint32_t id = vis_row[__builtin_ctz(remaining)];
+                const raster_setup_t *setup = &setups[id];
+                const __m256i lanes = _mm256_and_si256(drawn, _mm256_cmpeq_epi32(ids, _mm256_set1_epi32((int)id)));
+                remaining &= ~(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(lanes));
+
+                // The same steps get_span_attribs() takes, so the results match bit for bit
+                raster_attribs_t attribs;
+                if (id == last_id && y == last_y + 1 && (y & (RASTER_BLOCK_SIZE - 1))) {
+                    attribs.reciprocal_w = last_attribs.reciprocal_w + setup->reciprocal_w.dfdy;
+                    attribs.u_over_w = last_attribs.u_over_w + setup->u_over_w.dfdy;
+                    attribs.v_over_w = last_attribs.v_over_w + setup->v_over_w.dfdy;
+                } else {
+                    attribs = get_span_attribs(setup, span_x, y);
+                }
+                // Follow one triangle down the column, the last one in the row unless the followed one is still here
+                if (id == last_id || (remaining == 0 && last_y != y)) {
+                    last_id = id;
+                    last_y = y;
+                    last_attribs = attribs;
+                }
+
+                affine_span_t span;
+                const bool affine = affine_span_length
+                    && get_affine_span(attribs, span_x, setup, &span, &stats->max_affine_error);
+
+                __m256 u, v;
+                get_span_uv_avx2(attribs, setup, affine ? &span : NULL, &u, &v);
+                _mm256_maskstore_epi32((int *)row->colour, lanes, fetch_texels_avx2(setup->mip, u, v, lanes));
+            }
+        }
+    }
+}
+
+// 8-wide shade_affine_textured_span()
+__attribute__((target("avx2"))) static unsigned int shade_affine_textured_span_avx2(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+)
+{
+    const __m256 lane_index = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i lane_bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i coverage = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(mask), lane_bit), lane_bit);
+
+    framebuffer_row_t *row = get_framebuffer_row(get_framebuffer(), x, y);
+
+    const __m256 reciprocal_w = _mm256_add_ps(
+        _mm256_set1_ps(attribs.reciprocal_w),
+        _mm256_mul_ps(_mm256_set1_ps(setup->reciprocal_w.dfdx), lane_index)
+    );
+
+    // Depth test first so that spans that are entirely hidden never divide
+    const __m256 old_reciprocal_w = _mm256_maskload_ps(row->depth, coverage);
+    const __m256i pass = _mm256_and_si256(
+        coverage, _mm256_castps_si256(_mm256_cmp_ps(reciprocal_w, old_reciprocal_w, _CMP_GT_OQ))
+    );
+    if (_mm256_testz_si256(pass, pass)) {
+        return 0;
+    }
+
+    const unsigned int pass_mask = _mm256_movemask_ps(_mm256_castsi256_ps(pass));
+
+    affine_span_t span;
+    if (!get_affine_span(attribs, x, setup, &span, &stats->max_affine_error)) {
+        return shade_textured_span_avx2(x, y, pass_mask, attribs, setup, stats);
+    }
+
+    const __m256 t = _mm256_add_ps(_mm256_set1_ps(span.t), lane_index);
+    const __m256 u = _mm256_add_ps(_mm256_set1_ps(span.u), _mm256_mul_ps(_mm256_set1_ps(span.du), t));
+    const __m256 v = _mm256_add_ps(_mm256_set1_ps(span.v), _mm256_mul_ps(_mm256_set1_ps(span.dv), t));
+    const __m256i texels = fetch_texels_avx2(setup->mip, u, v, pass);
+    _mm256_maskstore_epi32((int *)row->colour, pass, texels);
+    _mm256_maskstore_ps(row->depth, pass, reciprocal_w);
+
+    return pass_mask;
+}
+
+#endif
+
+void init_span_kernels(void)
+{
+#ifdef HAVE_AVX2_SPANS
+    use_avx2 = SDL_HasAVX2();
+#endif
+}
+
+// Lengths other than powers of two from RASTER_BLOCK_SIZE to MAX_AFFINE_SPAN_LENGTH turn affine spans off
+void set_affine_span_length(const int length)
+{
+    const bool power_of_two = (length & (length - 1)) == 0;
+    affine_span_length = power_of_two && length >= RASTER_BLOCK_SIZE && length <= MAX_AFFINE_SPAN_LENGTH ? length : 0;
+
+    // Exact as the length is a power of two
+    affine_span_step = affine_span_length ? 1.0f / affine_span_length : 0;
+}
+
+int get_affine_span_length(void)
+{
+    return affine_span_length;
+}
+
+void resolve_visibility(
+    const raster_setup_t *setups,
+    const int min_x, const int min_y,
+    const int max_x, const int max_y,
+    raster_stats_t *stats
+)
+{
+#ifdef HAVE_AVX2_SPANS
+    if (use_avx2) {
+        resolve_visibility_avx2(setups, min_x, min_y, max_x, max_y, stats);
+        return;
+    }
+#endif
+    resolve_visibility_scalar(setups, min_x, min_y, max_x, max_y, stats);
+}
+
+raster_span_fn get_visibility_span_fn(void)
+{
+#ifdef HAVE_AVX2_SPANS
+    if (use_avx2) {
+        return shade_visibility_span_avx2;
+    }
+#endif
+    return shade_visibility_span;
+}
+
+raster_span_fn get_textured_span_fn(void)
+{
+#ifdef HAVE_AVX2_SPANS
+    if (use_avx2) {
+        return affine_span_length ? shade_affine_textured_span_avx2 : shade_textured_span_avx2;
+    }
+#endif
+    return affine_span_length ? shade_affine_textured_span : shade_textured_span;
+}
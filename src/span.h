@@ -0,0 +1,127 @@
+#ifndef SPAN_H_
+#define SPAN_H_
+
+#include "texture.h"
+#include <stdint.h>
+
+#define RASTER_BLOCK_SIZE 8
+
+/*
+ * Triangle setup
+ *
+ * 1/w, u/w and v/w are linear in screen space, so instead of recomputing barycentric weights at every pixel each
+ * attribute gets a plane equation once per triangle:
+ *
+ *   f(x, y) = f0 + df/dx * (x - x0) + df/dy * (y - y0)
+ *
+ * The plane equations are evaluated at the origin of every block and then stepped by the constant df/dx and
+ * df/dy deltas across the block.
+ */
+typedef struct {
+	float f0;
+	float dfdx;
+	float dfdy;
+} plane_eq_t;
+
+// Values of the interpolated attributes at the first pixel of a span
+typedef struct {
+	float reciprocal_w;
+	float u_over_w;
+	float v_over_w;
+} raster_attribs_t;
+
+// Per frame counters used to judge how much work the depth test saves and how far affine spans are off
+typedef struct {
+	int pixels_shaded;
+	int pixels_rejected;
+	int blocks_rejected;
+	float max_affine_error; // bound on how many texels an affine span strayed from the perspective-correct texel
+} raster_stats_t;
+
+typedef struct raster_setup raster_setup_t;
+
+// Shades up to RASTER_BLOCK_SIZE pixels starting at x, one bit of mask per pixel, returns the pixels written
+typedef unsigned int (*raster_span_fn)(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+);
+
+struct raster_setup {
+	// Screen space vertices in sub-pixel fixed point, wound so that the edge functions are positive inside the triangle
+	int x0, y0;
+	int x1, y1;
+	int x2, y2;
+
+	// Bounding box of the pixels covered by the triangle clamped to the screen
+	int min_x, min_y;
+	int max_x, max_y;
+
+	// Plane equations relative to (x0, y0)
+	plane_eq_t reciprocal_w;
+	plane_eq_t u_over_w;
+	plane_eq_t v_over_w;
+
+	// Largest and smallest 1/w of the three vertices i.e. the nearest and farthest depth anywhere on the triangle
+	float max_reciprocal_w;
+	float min_reciprocal_w;
+
+	uint32_t colour;
+	const mip_level_t *mip; // texture level picked for the whole triangle
+	raster_span_fn shade_span;
+
+	// Index of the triangle in the frame, written to the visibility buffer
+	uint32_t id;
+};
+
+/*
+ * Affine spans
+ *
+ * With an affine span length of N, u and v are divided by 1/w only every N pixels and interpolated linearly in
+ * between, trading a bounded texture coordinate error for most of the per-pixel divides (see span.c).
+ */
+#define MAX_AFFINE_SPAN_LENGTH 16
+
+void init_span_kernels(void);
+void set_affine_span_length(const int length);
+int get_affine_span_length(void);
+raster_span_fn get_textured_span_fn(void);
+raster_span_fn get_visibility_span_fn(void);
+unsigned int shade_fill_span(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+);
+unsigned int shade_textured_span(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+);
+unsigned int shade_affine_textured_span(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+);
+unsigned int shade_visibility_span(
+    const int x, const int y,
+    const unsigned int mask,
+    const raster_attribs_t attribs,
+    const raster_setup_t *setup,
+    raster_stats_t *stats
+);
+void resolve_visibility(
+    const raster_setup_t *setups,
+    const int min_x, const int min_y,
+    const int max_x, const int max_y,
+    raster_stats_t *stats
+);
+
+#endif // SPAN_H_
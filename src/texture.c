@@ -1,4 +1,13 @@
 #include "texture.h"
+#include "upng.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Texels of every level start on a cache line
+#define TEXTURE_ALIGNMENT 64
 
 tex2_t tex2_clone(tex2_t *t)
 {
@@ -7,3 +16,196 @@ tex2_t tex2_clone(tex2_t *t)
         .v = t->v,
     };
 }
+
+static int next_pow2(const int n)
+{
+    int p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+static int log2_int(int n)
+{
+    int bits = 0;
+    while (n > 1) {
+        n >>= 1;
+        bits++;
+    }
+    return bits;
+}
+
+// Reads the texel at (x, y) of a decoded png as RGBA32, returns false for formats that are not supported
+static bool read_png_texel(const upng_t *png, const int x, const int y, uint8_t rgba[4])
+{
+    const unsigned char *buffer = upng_get_buffer(png);
+    const int pixel_size = upng_get_pixelsize(png) / 8;
+    const unsigned char *pixel = buffer + ((size_t)upng_get_width(png) * y + x) * pixel_size;
+
+    switch (upng_get_format(png)) {
+    case UPNG_RGBA8:
+        memcpy(rgba, pixel, 4);
+        return true;
+    case UPNG_RGB8:
+        memcpy(rgba, pixel, 3);
+        rgba[3] = 0xFF;
+        return true;
+    case UPNG_LUMINANCE8:
+        rgba[0] = rgba[1] = rgba[2] = pixel[0];
+        rgba[3] = 0xFF;
+        return true;
+    case UPNG_LUMINANCE_ALPHA8:
+        rgba[0] = rgba[1] = rgba[2] = pixel[0];
+        rgba[3] = pixel[1];
+        return true;
+    default:
+        return false;
+    }
+}
+
+// Stores a level from row-major RGBA32 texels in Morton order
+static bool init_mip_level(mip_level_t *mip, const uint8_t *rgba, const int width, const int height)
+{
+    mip->width = width;
+    mip->height = height;
+    mip->morton_bits = log2_int(width < height ? width : height);
+
+    size_t size = sizeof(uint32_t) * width * height;
+    size = (size + TEXTURE_ALIGNMENT - 1) & ~(size_t)(TEXTURE_ALIGNMENT - 1);
+    mip->texels = (uint32_t *)aligned_alloc(TEXTURE_ALIGNMENT, size);
+    if (!mip->texels) {
+        fprintf(stderr, "error allocating texture\n");
+        return false;
+    }
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            memcpy(&mip->texels[get_texel_index(mip, x, y)], &rgba[((size_t)width * y + x) * 4], sizeof(uint32_t));
+        }
+    }
+
+    return true;
+}
+
+// Halves row-major RGBA32 texels in place with a box filter, a side that is already 1 stays 1
+static void downsample_rgba(uint8_t *rgba, const int width, const int height)
+{
+    const int half_width = width > 1 ? width / 2 : 1;
+    const int half_height = height > 1 ? height / 2 : 1;
+    const int step_x = width > 1 ? 1 : 0;
+    const int step_y = height > 1 ? width : 0;
+
+    // Each output texel only reads input texels at or after its own position, so this can run in place
+    for (int y = 0; y < half_height; y++) {
+        for (int x = 0; x < half_width; x++) {
+            const size_t src = (size_t)width * (y * (step_y ? 2 : 1)) + (x * (step_x ? 2 : 1));
+            for (int c = 0; c < 4; c++) {
+                const int sum = rgba[src * 4 + c]
+                    + rgba[(src + step_x) * 4 + c]
+                    + rgba[(src + step_y) * 4 + c]
+                    + rgba[(src + step_x + step_y) * 4 + c];
+                rgba[((size_t)half_width * y + x) * 4 + c] = (sum + 2) / 4;
+            }
+        }
+    }
+}
+
+texture_t *load_png_texture(const char *filename)
+{
+    upng_t *png = upng_new_from_file(filename);
+    if (!png) {
+        fprintf(stderr, "error loading .png\n");
+        return NULL;
+    }
+
+    upng_decode(png);
+    if (upng_get_error(png) != UPNG_EOK) {
+        fprintf(stderr, "error decoding .png\n");
+        upng_free(png);
+        return NULL;
+    }
+
+    const int png_width = upng_get_width(png);
+    const int png_height = upng_get_height(png);
+
+    // Other sizes are resampled up to the next power of two so that UVs still span the whole image
+    int width = next_pow2(png_width);
+    int height = next_pow2(png_height);
+
+    texture_t *texture = (texture_t *)calloc(1, sizeof(texture_t));
+    uint8_t *rgba = (uint8_t *)malloc((size_t)width * height * 4);
+    if (!texture || !rgba) {
+        fprintf(stderr, "error allocating texture\n");
+        free(texture);
+        free(rgba);
+        upng_free(png);
+        return NULL;
+    }
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const int png_x = (int)((int64_t)x * png_width / width);
+            const int png_y = (int)((int64_t)y * png_height / height);
+
+            // Same byte order as the RGBA32 colour buffer
+            if (!read_png_texel(png, png_x, png_y, &rgba[((size_t)width * y + x) * 4])) {
+                fprintf(stderr, "error unsupported .png format\n");
+                free(texture);
+                free(rgba);
+                upng_free(png);
+                return NULL;
+            }
+        }
+    }
+
+    upng_free(png);
+
+    for (;;) {
+        if (!init_mip_level(&texture->levels[texture->num_levels], rgba, width, height)) {
+            free_texture(texture);
+            free(rgba);
+            return NULL;
+        }
+        texture->num_levels++;
+
+        if ((width == 1 && height == 1) || texture->num_levels == MAX_MIP_LEVELS) {
+            break;
+        }
+
+        downsample_rgba(rgba, width, height);
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+    }
+
+    free(rgba);
+
+    return texture;
+}
+
+/*
+ * Picks the level whose texels are closest to one per pixel, given how many level 0 texels (texel_area) map onto
+ * how many pixels (pixel_area). Each level has a quarter of the texels of the one before it.
+ */
+int get_mip_level(const texture_t *texture, const float texel_area, const float pixel_area)
+{
+    int level = 0;
+    if (pixel_area > 0 && texel_area > pixel_area) {
+        level = (int)(0.5f * log2f(texel_area / pixel_area) + 0.5f);
+    }
+    if (level > texture->num_levels - 1) {
+        level = texture->num_levels - 1;
+    }
+    return level;
+}
+
+void free_texture(texture_t *texture)
+{
+    if (!texture) {
+        return;
+    }
+    for (int i = 0; i < texture->num_levels; i++) {
+        free(texture->levels[i].texels);
+    }
+    free(texture);
+}
@@ -1,11 +1,60 @@
 #ifndef TEXTURE_H_
 #define TEXTURE_H_
 
+#include <stdint.h>
+
 typedef struct {
     float u;
     float v;
 } tex2_t;
 
+// Enough levels to go from 65536 texels down to 1
+#define MAX_MIP_LEVELS 17
+
+/*
+ * Texture converted at load time for the rasteriser: RGBA32 texels like the colour buffer, power of two sides so
+ * that wrapping is a mask, and texels stored in Morton (Z) order so that texels close to each other in 2D are
+ * close to each other in memory whichever way a triangle walks across the texture.
+ */
+typedef struct {
+    uint32_t *texels;
+    int width;
+    int height;
+    int morton_bits; // log2 of the shorter side, the bits of x and y that are interleaved
+} mip_level_t;
+
+// Mip chain where each level is a 2x2 box filtered version of the one before, down to 1x1
+typedef struct {
+    mip_level_t levels[MAX_MIP_LEVELS];
+    int num_levels;
+} texture_t;
+
 tex2_t tex2_clone(tex2_t *tex);
 
+texture_t *load_png_texture(const char *filename);
+int get_mip_level(const texture_t *texture, const float texel_area, const float pixel_area);
+void free_texture(texture_t *texture);
+
+// Spreads the low 16 bits of v out to the even bits
+static inline uint32_t morton_spread(uint32_t v)
+{
+    v &= 0x0000FFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+// Index of texel (x, y) in texels, x and y must already be wrapped to the texture
+static inline uint32_t get_texel_index(const mip_level_t *mip, const uint32_t x, const uint32_t y)
+{
+    const uint32_t square_mask = (1u << mip->morton_bits) - 1;
+
+    // Bits past the shorter side are only ever set in one of x and y and continue on above the interleaved bits
+    return morton_spread(x & square_mask)
+        | (morton_spread(y & square_mask) << 1)
+        | (((x | y) >> mip->morton_bits) << (mip->morton_bits * 2));
+}
+
 #endif // TEXTURE_H_
@@ -0,0 +1,125 @@
+#include "array.h"
+#include "display.h"
+#include "job.h"
+#include "span.h"
+#include "tile.h"
+#include "triangle.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Tiled rasterisation
+ *
+ * The screen is split into TILE_SIZE x TILE_SIZE tiles. Each set up triangle is binned into every tile that its
+ * bounding box overlaps and the tiles are then handed out to the job pool, so every tile's pixels are only ever
+ * written by the one thread rasterising it. Within a tile the triangles are rasterised in submission order and
+ * attributes are evaluated per block independently of the tile rectangle, so the image does not depend on the
+ * number of threads.
+ */
+
+static int num_tiles_x = 0;
+static int num_tiles_y = 0;
+
+static raster_setup_t *setups = NULL;
+static int **bins = NULL;
+
+// Each tile counts into its own stats so the jobs never share a counter
+static raster_stats_t *tile_stats = NULL;
+
+bool init_tiles(void)
+{
+    num_tiles_x = (get_win_width() + TILE_SIZE - 1) / TILE_SIZE;
+    num_tiles_y = (get_win_height() + TILE_SIZE - 1) / TILE_SIZE;
+
+    bins = (int **)calloc(num_tiles_x * num_tiles_y, sizeof(int *));
+    if (!bins) {
+        fprintf(stderr, "error allocating tile bins\n");
+        return false;
+    }
+
+    tile_stats = (raster_stats_t *)calloc(num_tiles_x * num_tiles_y, sizeof(raster_stats_t));
+    if (!tile_stats) {
+        fprintf(stderr, "error allocating tile stats\n");
+        return false;
+    }
+
+    return true;
+}
+
+void clear_tiles(void)
+{
+    array_clear(setups);
+    for (int i = 0; i < num_tiles_x * num_tiles_y; i++) {
+        array_clear(bins[i]);
+    }
+}
+
+void bin_triangle(const raster_setup_t *setup)
+{
+    const int idx = array_length(setups);
+    array_push(setups, *setup);
+    setups[idx].id = idx;
+
+    for (int tile_y = setup->min_y / TILE_SIZE; tile_y <= setup->max_y / TILE_SIZE; tile_y++) {
+        for (int tile_x = setup->min_x / TILE_SIZE; tile_x <= setup->max_x / TILE_SIZE; tile_x++) {
+            array_push(bins[(tile_y * num_tiles_x) + tile_x], idx);
+        }
+    }
+}
+
+static void render_tile(const int tile_idx, void *data)
+{
+    (void)data;
+
+    const int min_x = (tile_idx % num_tiles_x) * TILE_SIZE;
+    const int min_y = (tile_idx / num_tiles_x) * TILE_SIZE;
+    const int max_x = min_x + TILE_SIZE - 1;
+    const int max_y = min_y + TILE_SIZE - 1;
+
+    raster_stats_t *stats = &tile_stats[tile_idx];
+    *stats = (raster_stats_t) { 0 };
+
+    const int *bin = bins[tile_idx];
+    const int num_triangles = array_length((void *)bin);
+    for (int i = 0; i < num_triangles; i++) {
+        rasterise_triangle(&setups[bin[i]], min_x, min_y, max_x, max_y, stats);
+    }
+
+    if (should_render_visibility_buffer()) {
+        resolve_visibility(setups, min_x, min_y, max_x, max_y, stats);
+    }
+}
+
+void render_tiles(void)
+{
+    run_jobs(render_tile, num_tiles_x * num_tiles_y, NULL);
+}
+
+raster_stats_t get_tile_stats(void)
+{
+    raster_stats_t total = { 0 };
+    for (int i = 0; i < num_tiles_x * num_tiles_y; i++) {
+        total.pixels_shaded += tile_stats[i].pixels_shaded;
+        total.pixels_rejected += tile_stats[i].pixels_rejected;
+        total.blocks_rejected += tile_stats[i].blocks_rejected;
+        if (tile_stats[i].max_affine_error > total.max_affine_error) {
+            total.max_affine_error = tile_stats[i].max_affine_error;
+        }
+    }
+    return total;
+}
+
+void free_tiles(void)
+{
+    if (bins) {
+        for (int i = 0; i < num_tiles_x * num_tiles_y; i++) {
+            array_free(bins[i]);
+        }
+        free(bins);
+        bins = NULL;
+    }
+    free(tile_stats);
+    tile_stats = NULL;
+    array_free(setups);
+    setups = NULL;
+}
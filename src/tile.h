@@ -0,0 +1,17 @@
+#ifndef TILE_H_
+#define TILE_H_
+
+#include "span.h"
+#include <stdbool.h>
+
+// Must be a multiple of RASTER_BLOCK_SIZE so that blocks never straddle two tiles
+#define TILE_SIZE 64
+
+bool init_tiles(void);
+void clear_tiles(void);
+void bin_triangle(const raster_setup_t *setup);
+void render_tiles(void);
+raster_stats_t get_tile_stats(void);
+void free_tiles(void);
+
+#endif // TILE_H_
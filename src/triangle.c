@@ -1,9 +1,10 @@
 #include "SDL_events.h"
 #include "display.h"
+#include "span.h"
 #include "texture.h"
 #include "triangle.h"
-#include "upng.h"
 #include "vector.h"
+#include <math.h>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -23,314 +24,348 @@ static void float_swap(float *a, float *b)
     *b = t;
 }
 
-void draw_triangle(const int x0, const int y0, const int x1, const int y1, const int x2, const int y2, uint32_t colour)
+/*
+ * Half-space rasteriser
+ *
+ * Vertices are snapped to a fixed point grid with SUBPIXEL_BITS fractional bits and each edge of the triangle is
+ * an integer edge function E(x, y) that is positive on the inside of the edge, sampled at pixel centres.
+ * The bounding box of the triangle is walked in RASTER_BLOCK_SIZE x RASTER_BLOCK_SIZE blocks aligned to the
+ * screen; a block is rejected outright only when all four of its corners are outside of the same edge, a block with
+ * all corners inside of every edge is shaded without any per-pixel edge tests, and anything else is tested per pixel.
+ *
+ *   E(x, y) = (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x)
+ *   E(x + 1, y) = E(x, y) + (a.y - b.y)
+ *   E(x, y + 1) = E(x, y) + (b.x - a.x)
+ *
+ * A pixel centre that lies exactly on an edge belongs to the triangle only if it is a top or left edge, so pixels
+ * on an edge shared by two triangles are shaded exactly once.
+ *
+ * Covered pixels are handed to a span kernel one block row at a time (see span.c).
+ *
+ * Before a block is shaded, the nearest depth the triangle can reach inside it is compared against the farthest
+ * depth already in that tile of the framebuffer, and the block is skipped if every pixel would fail the depth test.
+ */
+_Static_assert(RASTER_BLOCK_SIZE == FRAMEBUFFER_TILE_SIZE, "rasteriser blocks must match the framebuffer tiles");
+
+#define SUBPIXEL_BITS 4
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+
+// Margin for the rounding of stepped 1/w values within a block, keeps the coarse depth rejection conservative
+#define HIZ_EPSILON 1e-4
+static inline int min_int(const int a, const int b)
 {
-    draw_line(x0, y0, x1, y1, colour);
-    draw_line(x1, y1, x2, y2, colour);
-    draw_line(x2, y2, x0, y0, colour);
+    return a < b ? a : b;
 }
 
-void draw_fill_triangle(
-    int x0, int y0, float z0, float w0,
-    int x1, int y1, float z1, float w1,
-    int x2, int y2, float z2, float w2,
-    const uint32_t colour
-)
+static inline int max_int(const int a, const int b)
 {
-    // Sort vertices by y-coord asc (y0 < y1 < y2)
-    if (y0 > y1) {
-        SWAP(&y0, &y1);
-        SWAP(&x0, &x1);
-        SWAP(&z0, &z1);
-        SWAP(&w0, &w1);
-    }
-    if (y1 > y2) {
-        SWAP(&y1, &y2);
-        SWAP(&x1, &x2);
-        SWAP(&z1, &z2);
-        SWAP(&w1, &w2);
-    }
-    if (y0 > y1) {
-        SWAP(&y0, &y1);
-        SWAP(&x0, &x1);
-        SWAP(&z0, &z1);
-        SWAP(&w0, &w1);
-    }
-
-    const vec4_t point_a = { x0, y0, z0, w0 };
-    const vec4_t point_b = { x1, y1, z1, w1 };
-    const vec4_t point_c = { x2, y2, z2, w2 };
-
-    // Render the top of the triangle i.e. the flat bottomed triangle
-    // Inverse slope because we need to calculate the y increment
-    float inv_slope1 = 0;
-    if (y1 - y0 != 0) { // Guard against div by zero
-        inv_slope1 = (float)(x1 - x0) / abs(y1 - y0);
-    }
-
-    float inv_slope2 = 0;
-    if (y2 - y0 != 0) { // Guard against div by zero
-        inv_slope2 = (float)(x2 - x0) / abs(y2 - y0);
-    }
-
-    if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
-            int xstart = x1 + (y - y1) * inv_slope1;
-            int xend = x0 + (y - y0) * inv_slope2;
-
-            if (xend < xstart) {
-                SWAP(&xstart, &xend);
-            }
+    return a > b ? a : b;
+}
 
-            for (int x = xstart; x < xend; x++) {
-                draw_triangle_pixel(x, y, colour, point_a, point_b, point_c);
-            }
-        }
-    }
+static inline int64_t min_int64(const int64_t a, const int64_t b)
+{
+    return a < b ? a : b;
+}
 
-    // Render the bottom of the triangle i.e. the flat topped triangle
-    // Inverse slope because we need to calculate the y increment
-    inv_slope1 = 0;
-    if (y2 - y1 != 0) { // Guard against div by zero
-        inv_slope1 = (float)(x2 - x1) / abs(y2 - y1);
-    }
+static inline int64_t max_int64(const int64_t a, const int64_t b)
+{
+    return a > b ? a : b;
+}
 
-    inv_slope2 = 0;
-    if (y2 - y0 != 0) { // Guard against div by zero
-        inv_slope2 = (float)(x2 - x0) / abs(y2 - y0);
-    }
+// Products of sub-pixel coordinates overflow 32 bits on large screens
+static inline int64_t orient2d(const int ax, const int ay, const int bx, const int by, const int px, const int py)
+{
+    return (int64_t)(bx - ax) * (py - ay) - (int64_t)(by - ay) * (px - ax);
+}
 
-    if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
-            int xstart = x1 + (y - y1) * inv_slope1;
-            int xend = x0 + (y - y0) * inv_slope2;
+static inline int snap_to_subpixel(const float v)
+{
+    return (int)lroundf(v * SUBPIXEL_ONE);
+}
 
-            if (xend < xstart) {
-                SWAP(&xstart, &xend);
-            }
+// Sub-pixel coordinate of the centre of pixel p
+static inline int pixel_centre(const int p)
+{
+    return (p << SUBPIXEL_BITS) + (SUBPIXEL_ONE / 2);
+}
 
-            for (int x = xstart; x < xend; x++) {
-                draw_triangle_pixel(x, y, colour, point_a, point_b, point_c);
-            }
-        }
-    }
+// Pixel centres exactly on an edge a -> b are only inside if it is a top or left edge
+static inline int64_t edge_bias(const int ax, const int ay, const int bx, const int by)
+{
+    const bool is_top = ay == by && bx > ax;
+    const bool is_left = by < ay;
+    return is_top || is_left ? 0 : -1;
 }
 
-vec3_t barycentric_weights(const vec2_t a, const vec2_t b, vec2_t c, vec2_t p)
+// Vertex positions are in pixels relative to vertex 0
+static plane_eq_t plane_eq_from_vertices(
+    const float f0,
+    const float x1, const float y1, const float f1,
+    const float x2, const float y2, const float f2,
+    const float inv_area
+)
 {
-    /*
-     *          B
-     *         /|\
-     *        / | \
-     *       /  |  \
-     *      /  (p)  \
-     *     /  /   \  \
-     *    / /       \ \
-     *   //___________\\
-     *  A               C
-     */
-    // Vectors between vertices
-    const vec2_t ac = vec2_sub(c, a);
-    const vec2_t ab = vec2_sub(b, a);
-    const vec2_t ap = vec2_sub(p, a);
-    const vec2_t pc = vec2_sub(c, p);
-    const vec2_t pb = vec2_sub(b, p);
-
-    // Calculate area of ABC (parallegram/triangle ABC) "2D cross product"
-    const float area_para_abc = ac.x * ab.y - ac.y * ab.x; // || AC x AB ||
-
-    // α which is area PBC / area ABC
-    const float alpha = (pc.x * pb.y - pc.y * pb.x) / area_para_abc;
-
-    // β which is area APC / area ABC
-    const float beta = (ac.x * ap.y - ac.y * ap.x) / area_para_abc;
-
-    // γ is what's left of 1.0 - α - β because barycentric coords add up to 1.0
-    const float gamma = 1 - alpha - beta;
-
-    return (vec3_t) {
-        alpha, beta, gamma
+    return (plane_eq_t) {
+        .f0 = f0,
+        .dfdx = ((f1 - f0) * y2 - (f2 - f0) * y1) * inv_area,
+        .dfdy = ((f2 - f0) * x1 - (f1 - f0) * x2) * inv_area,
     };
 }
 
-void draw_triangle_pixel(
-    const int x, const int y,
-    const uint32_t colour,
-    const vec4_t point_a, const vec4_t point_b, const vec4_t point_c
-)
+// Evaluates a plane equation at the centre of the pixel (x, y)
+static inline float plane_eq_at(const plane_eq_t *plane, const raster_setup_t *setup, const int x, const int y)
 {
-    const vec2_t p = { x, y };
-    const vec2_t a = vec2_from_vec4(point_a);
-    const vec2_t b = vec2_from_vec4(point_b);
-    const vec2_t c = vec2_from_vec4(point_c);
-    const vec3_t weights = barycentric_weights(a, b, c, p);
-    const float alpha = weights.x;
-    const float beta = weights.y;
-    const float gamma = weights.z;
-
-    // Interpolate the value of 1/w for current pixel
-    // TODO: pull out this reciprocal calc out of this func
-    float interpolated_reciprocal_w = (1 / point_a.w) * alpha + (1 / point_b.w) * beta + (1 / point_c.w) * gamma;
-
-    // Adjust 1/w so that pixels closer to camera are smaller than those behind
-    interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
-
-    // Only draw pixel if depth value is less than what was already in z_buf
-    if (interpolated_reciprocal_w < get_zbuf_at(x, y)) {
-        draw_pixel(x, y, colour);
-
-        // Update z_buf with the 1/w of current pixel
-        update_zbuf_at(x, y, interpolated_reciprocal_w);
-    }
+    const float dx = (float)(pixel_centre(x) - setup->x0) / SUBPIXEL_ONE;
+    const float dy = (float)(pixel_centre(y) - setup->y0) / SUBPIXEL_ONE;
+    return plane->f0 + plane->dfdx * dx + plane->dfdy * dy;
 }
 
-void draw_triangle_texel(
-    const int x, const int y,
-    const upng_t *texture,
-    const vec4_t point_a, const vec4_t point_b, const vec4_t point_c,
-    const tex2_t a_uv, const tex2_t b_uv, const tex2_t c_uv
+// Vertex attributes are already divided by w, positions are in pixels
+static bool setup_triangle(
+    raster_setup_t *setup,
+    const float fx0, const float fy0, const float reciprocal_w0, const float u_over_w0, const float v_over_w0,
+    const float fx1, const float fy1, const float reciprocal_w1, const float u_over_w1, const float v_over_w1,
+    const float fx2, const float fy2, const float reciprocal_w2, const float u_over_w2, const float v_over_w2
 )
 {
-    const vec2_t p = { x, y };
-    const vec2_t a = vec2_from_vec4(point_a);
-    const vec2_t b = vec2_from_vec4(point_b);
-    const vec2_t c = vec2_from_vec4(point_c);
-    const vec3_t weights = barycentric_weights(a, b, c, p);
-    const float alpha = weights.x;
-    const float beta = weights.y;
-    const float gamma = weights.z;
+    const int x0 = snap_to_subpixel(fx0), y0 = snap_to_subpixel(fy0);
+    int x1 = snap_to_subpixel(fx1), y1 = snap_to_subpixel(fy1);
+    int x2 = snap_to_subpixel(fx2), y2 = snap_to_subpixel(fy2);
 
-    // Interpolate U/w and V/w values using barycentric weights and a factor of 1/w
-    float interpolated_u = (a_uv.u / point_a.w) * alpha + (b_uv.u / point_b.w) * beta + (c_uv.u / point_c.w) * gamma;
-    float interpolated_v = (a_uv.v / point_a.w) * alpha + (b_uv.v / point_b.w) * beta + (c_uv.v / point_c.w) * gamma;
+    const int64_t area = orient2d(x0, y0, x1, y1, x2, y2);
+    if (area == 0) {
+        return false;
+    }
 
-    // Interpolate the value of 1/w for current pixel
-    // TODO: pull out this reciprocal calc out of this func
-    float interpolated_reciprocal_w = (1 / point_a.w) * alpha + (1 / point_b.w) * beta + (1 / point_c.w) * gamma;
+    // Pixels whose centres are within the bounding box of the triangle, clamped to the screen
+    const int half_pixel = SUBPIXEL_ONE / 2;
+    setup->min_x = max_int((min_int(x0, min_int(x1, x2)) - half_pixel + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, 0);
+    setup->min_y = max_int((min_int(y0, min_int(y1, y2)) - half_pixel + SUBPIXEL_ONE - 1) >> SUBPIXEL_BITS, 0);
+    setup->max_x = min_int((max_int(x0, max_int(x1, x2)) - half_pixel) >> SUBPIXEL_BITS, get_win_width() - 1);
+    setup->max_y = min_int((max_int(y0, max_int(y1, y2)) - half_pixel) >> SUBPIXEL_BITS, get_win_height() - 1);
+    if (setup->min_x > setup->max_x || setup->min_y > setup->max_y) {
+        return false;
+    }
 
-    // Divide the values back by 1/w to "reverse" the reciprocal calulation
-    interpolated_u /= interpolated_reciprocal_w;
-    interpolated_v /= interpolated_reciprocal_w;
+    const float inv_area = (float)(SUBPIXEL_ONE * SUBPIXEL_ONE) / area;
+
+    // Snapped vertices in pixels relative to vertex 0
+    const float dx1 = (float)(x1 - x0) / SUBPIXEL_ONE, dy1 = (float)(y1 - y0) / SUBPIXEL_ONE;
+    const float dx2 = (float)(x2 - x0) / SUBPIXEL_ONE, dy2 = (float)(y2 - y0) / SUBPIXEL_ONE;
+
+    setup->reciprocal_w = plane_eq_from_vertices(
+        reciprocal_w0,
+        dx1, dy1, reciprocal_w1,
+        dx2, dy2, reciprocal_w2,
+        inv_area
+    );
+    setup->u_over_w = plane_eq_from_vertices(
+        u_over_w0,
+        dx1, dy1, u_over_w1,
+        dx2, dy2, u_over_w2,
+        inv_area
+    );
+    setup->v_over_w = plane_eq_from_vertices(
+        v_over_w0,
+        dx1, dy1, v_over_w1,
+        dx2, dy2, v_over_w2,
+        inv_area
+    );
+
+    setup->max_reciprocal_w = fmaxf(fmaxf(reciprocal_w0, reciprocal_w1), reciprocal_w2);
+    setup->min_reciprocal_w = fminf(fminf(reciprocal_w0, reciprocal_w1), reciprocal_w2);
+
+    // Wind the triangle so that all three edge functions are positive on the inside
+    if (area < 0) {
+        SWAP(&x1, &x2);
+        SWAP(&y1, &y2);
+    }
 
-    const int texture_width = upng_get_width(texture);
-    const int texture_height = upng_get_height(texture);
+    setup->x0 = x0;
+    setup->y0 = y0;
+    setup->x1 = x1;
+    setup->y1 = y1;
+    setup->x2 = x2;
+    setup->y2 = y2;
 
-    // Map UV coords to texture width and height
-    const int tex_x = abs((int)(interpolated_u * texture_width) % texture_width); // Clamp value within tex width
-    const int tex_y = abs((int)(interpolated_v * texture_width) % texture_height); // Clamp value within tex height
+    return true;
+}
 
-    // Adjust 1/w so that pixels closer to camera are smaller than those behind
-    interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+// Sets up a queued triangle to be filled with its flat colour
+bool setup_fill_triangle(raster_setup_t *setup, const render_queue_t *queue, const int idx)
+{
+    setup->colour = queue->colour[idx];
+    setup->mip = NULL;
+    setup->shade_span = shade_fill_span;
+
+    return setup_triangle(
+        setup,
+        queue->x[0][idx], queue->y[0][idx], queue->reciprocal_w[0][idx], 0, 0,
+        queue->x[1][idx], queue->y[1][idx], queue->reciprocal_w[1][idx], 0, 0,
+        queue->x[2][idx], queue->y[2][idx], queue->reciprocal_w[2][idx], 0, 0
+    );
+}
 
-    // Only draw pixel if depth value is less than what was already in z_buf
-    if (interpolated_reciprocal_w < get_zbuf_at(x, y)) {
-        const uint32_t *texture_buffer = (uint32_t *)upng_get_buffer(texture);
+// Sets up a queued triangle to be textured with the mip level picked when it was queued
+bool setup_textured_triangle(raster_setup_t *setup, const render_queue_t *queue, const int idx)
+{
+    const texture_t *texture = get_material(queue->material[idx]);
+    if (!texture) {
+        return false;
+    }
 
-        draw_pixel(x, y, texture_buffer[(texture_width * tex_y) + tex_x]);
+    setup->colour = 0;
+    setup->shade_span = get_textured_span_fn();
+    setup->mip = &texture->levels[queue->mip_level[idx]];
 
-        // Update z_buf with the 1/w of current pixel
-        update_zbuf_at(x, y, interpolated_reciprocal_w);
-    }
+    return setup_triangle(
+        setup,
+        queue->x[0][idx], queue->y[0][idx], queue->reciprocal_w[0][idx], queue->u_over_w[0][idx], queue->v_over_w[0][idx],
+        queue->x[1][idx], queue->y[1][idx], queue->reciprocal_w[1][idx], queue->u_over_w[1][idx], queue->v_over_w[1][idx],
+        queue->x[2][idx], queue->y[2][idx], queue->reciprocal_w[2][idx], queue->u_over_w[2][idx], queue->v_over_w[2][idx]
+    );
 }
 
-void draw_textured_triangle(
-    int x0, int y0, float z0, float w0, float u0, float v0,
-    int x1, int y1, float z1, float w1, float u1, float v1,
-    int x2, int y2, float z2, float w2, float u2, float v2,
-    const upng_t *texture
+void rasterise_triangle(
+    const raster_setup_t *setup,
+    const int scissor_min_x, const int scissor_min_y,
+    const int scissor_max_x, const int scissor_max_y,
+    raster_stats_t *stats
 )
 {
-    // Sort vertices by y-coord asc (y0 < y1 < y2)
-    if (y0 > y1) {
-        SWAP(&y0, &y1);
-        SWAP(&x0, &x1);
-        SWAP(&z0, &z1);
-        SWAP(&w0, &w1);
-        SWAP(&u0, &u1);
-        SWAP(&v0, &v1);
-    }
-    if (y1 > y2) {
-        SWAP(&y1, &y2);
-        SWAP(&x1, &x2);
-        SWAP(&z1, &z2);
-        SWAP(&w1, &w2);
-        SWAP(&u1, &u2);
-        SWAP(&v1, &v2);
-    }
-    if (y0 > y1) {
-        SWAP(&y0, &y1);
-        SWAP(&x0, &x1);
-        SWAP(&z0, &z1);
-        SWAP(&w0, &w1);
-        SWAP(&u0, &u1);
-        SWAP(&v0, &v1);
-    }
-
-    // Flip V component to account for inverted UV coords
-    v0 = 1.0 - v0;
-    v1 = 1.0 - v1;
-    v2 = 1.0 - v2;
-
-    const vec4_t point_a = { x0, y0, z0, w0 };
-    const vec4_t point_b = { x1, y1, z1, w1 };
-    const vec4_t point_c = { x2, y2, z2, w2 };
-    const tex2_t a_uv = { u0, v0 };
-    const tex2_t b_uv = { u1, v1 };
-    const tex2_t c_uv = { u2, v2 };
-
-    // Render the top of the triangle i.e. the flat bottomed triangle
-    // Inverse slope because we need to calculate the y increment
-    float inv_slope1 = 0;
-    if (y1 - y0 != 0) { // Guard against div by zero
-        inv_slope1 = (float)(x1 - x0) / abs(y1 - y0);
+    const int x0 = setup->x0, y0 = setup->y0;
+    const int x1 = setup->x1, y1 = setup->y1;
+    const int x2 = setup->x2, y2 = setup->y2;
+    framebuffer_t *framebuffer = get_framebuffer();
+
+    const int min_x = max_int(setup->min_x, scissor_min_x);
+    const int min_y = max_int(setup->min_y, scissor_min_y);
+    const int max_x = min_int(setup->max_x, scissor_max_x);
+    const int max_y = min_int(setup->max_y, scissor_max_y);
+    if (min_x > max_x || min_y > max_y) {
+        return;
     }
 
-    float inv_slope2 = 0;
-    if (y2 - y0 != 0) { // Guard against div by zero
-        inv_slope2 = (float)(x2 - x0) / abs(y2 - y0);
-    }
+    // Per-pixel increments of edge functions w0 (v1 -> v2), w1 (v2 -> v0) and w2 (v0 -> v1)
+    const int64_t a0 = (int64_t)(y1 - y2) * SUBPIXEL_ONE, b0 = (int64_t)(x2 - x1) * SUBPIXEL_ONE;
+    const int64_t a1 = (int64_t)(y2 - y0) * SUBPIXEL_ONE, b1 = (int64_t)(x0 - x2) * SUBPIXEL_ONE;
+    const int64_t a2 = (int64_t)(y0 - y1) * SUBPIXEL_ONE, b2 = (int64_t)(x1 - x0) * SUBPIXEL_ONE;
+
+    // Pixel centres on an edge that is not a top or left edge are pushed outside
+    const int64_t bias0 = edge_bias(x1, y1, x2, y2);
+    const int64_t bias1 = edge_bias(x2, y2, x0, y0);
+    const int64_t bias2 = edge_bias(x0, y0, x1, y1);
+
+    // Increments from a block's origin to its far corners
+    const int span = RASTER_BLOCK_SIZE - 1;
+
+    for (int block_y = min_y & ~span; block_y <= max_y; block_y += RASTER_BLOCK_SIZE) {
+        for (int block_x = min_x & ~span; block_x <= max_x; block_x += RASTER_BLOCK_SIZE) {
+            const int centre_x = pixel_centre(block_x);
+            const int centre_y = pixel_centre(block_y);
+            int64_t w0 = orient2d(x1, y1, x2, y2, centre_x, centre_y) + bias0;
+            int64_t w1 = orient2d(x2, y2, x0, y0, centre_x, centre_y) + bias1;
+            int64_t w2 = orient2d(x0, y0, x1, y1, centre_x, centre_y) + bias2;
+
+            // Reject the block if all of its corners are outside of any single edge
+            if (w0 + max_int64(a0 * span, 0) + max_int64(b0 * span, 0) < 0
+                || w1 + max_int64(a1 * span, 0) + max_int64(b1 * span, 0) < 0
+                || w2 + max_int64(a2 * span, 0) + max_int64(b2 * span, 0) < 0) {
+                continue;
+            }
 
-    if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
-            int xstart = x1 + (y - y1) * inv_slope1;
-            int xend = x0 + (y - y0) * inv_slope2;
+            // Accept the whole block if all of its corners are inside of every edge
+            const bool covered = w0 + min_int64(a0 * span, 0) + min_int64(b0 * span, 0) >= 0
+                && w1 + min_int64(a1 * span, 0) + min_int64(b1 * span, 0) >= 0
+                && w2 + min_int64(a2 * span, 0) + min_int64(b2 * span, 0) >= 0;
+
+            // Pixels of each row that are within the clamped bounding box
+            const int start_x = max_int(block_x, min_x);
+            const int end_x = min_int(block_x + span, max_x);
+            const unsigned int bbox_mask = ((2u << (end_x - block_x)) - 1) & ~((1u << (start_x - block_x)) - 1);
+
+            // Evaluate the attributes at the block origin and step them down the rows
+            raster_attribs_t attribs = {
+                .reciprocal_w = plane_eq_at(&setup->reciprocal_w, setup, block_x, block_y),
+                .u_over_w = plane_eq_at(&setup->u_over_w, setup, block_x, block_y),
+                .v_over_w = plane_eq_at(&setup->v_over_w, setup, block_x, block_y),
+            };
+
+            // Skip the block if the nearest the triangle can get within it is behind everything already drawn there
+            const float block_max_reciprocal_w = attribs.reciprocal_w
+                + fmaxf(setup->reciprocal_w.dfdx * span, 0)
+                + fmaxf(setup->reciprocal_w.dfdy * span, 0);
+            const float nearest_reciprocal_w = fminf(block_max_reciprocal_w, setup->max_reciprocal_w);
+            if (nearest_reciprocal_w < get_framebuffer_tile_far(framebuffer, block_x, block_y) - HIZ_EPSILON) {
+                stats->blocks_rejected++;
+                continue;
+            }
 
-            if (xend < xstart) {
-                SWAP(&xstart, &xend);
+            unsigned int written = 0;
+
+            for (int y = block_y; y <= block_y + span; y++) {
+                if (y >= min_y && y <= max_y) {
+                    unsigned int mask = bbox_mask;
+
+                    if (!covered) {
+                        mask = 0;
+                        for (int i = 0; i < RASTER_BLOCK_SIZE; i++) {
+                            if (((w0 + a0 * i) | (w1 + a1 * i) | (w2 + a2 * i)) >= 0) {
+                                mask |= 1u << i;
+                            }
+                        }
+                        mask &= bbox_mask;
+                    }
+
+                    if (mask) {
+                        const unsigned int row_written = setup->shade_span(block_x, y, mask, attribs, setup, stats);
+                        stats->pixels_shaded += __builtin_popcount(row_written);
+                        stats->pixels_rejected += __builtin_popcount(mask & ~row_written);
+                        written |= row_written;
+                    }
+                }
+
+                w0 += b0;
+                w1 += b1;
+                w2 += b2;
+                attribs.reciprocal_w += setup->reciprocal_w.dfdy;
+                attribs.u_over_w += setup->u_over_w.dfdy;
+                attribs.v_over_w += setup->v_over_w.dfdy;
             }
 
-            for (int x = xstart; x < xend; x++) {
-                draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
+            if (written) {
+                update_framebuffer_tile_far(framebuffer, block_x, block_y);
             }
         }
     }
+}
 
-    // Render the bottom of the triangle i.e. the flat topped triangle
-    // Inverse slope because we need to calculate the y increment
-    inv_slope1 = 0;
-    if (y2 - y1 != 0) { // Guard against div by zero
-        inv_slope1 = (float)(x2 - x1) / abs(y2 - y1);
-    }
+raster_attribs_t get_span_attribs(const raster_setup_t *setup, const int x, const int y)
+{
+    const int block_x = x & ~(RASTER_BLOCK_SIZE - 1);
+    const int block_y = y & ~(RASTER_BLOCK_SIZE - 1);
+
+    // Repeat the exact steps rasterise_triangle() takes to reach this row, so the results match bit for bit
+    raster_attribs_t attribs = {
+        .reciprocal_w = plane_eq_at(&setup->reciprocal_w, setup, block_x, block_y),
+        .u_over_w = plane_eq_at(&setup->u_over_w, setup, block_x, block_y),
+        .v_over_w = plane_eq_at(&setup->v_over_w, setup, block_x, block_y),
+    };
 
-    inv_slope2 = 0;
-    if (y2 - y0 != 0) { // Guard against div by zero
-        inv_slope2 = (float)(x2 - x0) / abs(y2 - y0);
+    for (int row = block_y; row < y; row++) {
+        attribs.reciprocal_w += setup->reciprocal_w.dfdy;
+        attribs.u_over_w += setup->u_over_w.dfdy;
+        attribs.v_over_w += setup->v_over_w.dfdy;
     }
 
-    if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
-            int xstart = x1 + (y - y1) * inv_slope1;
-            int xend = x0 + (y - y0) * inv_slope2;
-
-            if (xend < xstart) {
-                SWAP(&xstart, &xend);
-            }
+    return attribs;
+}
 
-            for (int x = xstart; x < xend; x++) {
-                draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
-            }
-        }
-    }
+void draw_triangle(const int x0, const int y0, const int x1, const int y1, const int x2, const int y2, uint32_t colour)
+{
+    draw_line(x0, y0, x1, y1, colour);
+    draw_line(x1, y1, x2, y2, colour);
+    draw_line(x2, y2, x0, y0, colour);
 }
 
 vec3_t get_triangle_normal(vec4_t vertices[NUM_TRIANGLE_VERTICES])
@@ -152,6 +152,18 @@ vec3_t vec3_rotate_z(const vec3_t v, const float angle)
     };
 }
 
+// Perform perspective divide with original z value stored in w
+vec4_t vec4_perspective_divide(vec4_t v)
+{
+    if (v.w != 0.0) {
+        v.x /= v.w;
+        v.y /= v.w;
+        v.z /= v.w;
+    }
+
+    return v;
+}
+
 vec4_t vec4_from_vec3(const vec3_t v)
 {
     return (vec4_t) {
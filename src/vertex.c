@@ -0,0 +1,246 @@
+#include "SDL_cpuinfo.h"
+#include "vertex.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Batch transform kernels
+ *
+ * Every kernel evaluates m * v as ((m0 * x + m1 * y) + m2 * z) + m3 * w, in the same order as mat4_mul_vec4(), so
+ * the scalar, SSE and AVX kernels produce exactly the same vertices.
+ */
+
+#if defined(__SSE__)
+#define HAVE_SSE_TRANSFORM
+#include <xmmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX_TRANSFORM
+#include <immintrin.h>
+#endif
+
+#define VERTEX_ALIGNMENT 64
+
+// Streams are padded to whole cache lines, which is also a multiple of VERTEX_BATCH_SIZE
+#define VERTEX_STREAM_ALIGN_COUNT (VERTEX_ALIGNMENT / sizeof(float))
+
+_Static_assert(VERTEX_STREAM_ALIGN_COUNT % VERTEX_BATCH_SIZE == 0, "vertex streams must hold whole batches");
+
+// The four streams share one allocation that starts at x
+bool init_vertex_soa(vertex_soa_t *soa, const int count)
+{
+    size_t padded = ((size_t)count + VERTEX_STREAM_ALIGN_COUNT - 1) & ~(VERTEX_STREAM_ALIGN_COUNT - 1);
+    if (padded == 0) {
+        padded = VERTEX_STREAM_ALIGN_COUNT;
+    }
+
+    float *streams = (float *)aligned_alloc(VERTEX_ALIGNMENT, sizeof(float) * padded * 4);
+    if (!streams) {
+        fprintf(stderr, "error allocating vertex streams\n");
+        return false;
+    }
+    memset(streams, 0, sizeof(float) * padded * 4);
+
+    soa->x = streams;
+    soa->y = streams + padded;
+    soa->z = streams + (padded * 2);
+    soa->w = streams + (padded * 3);
+    soa->count = count;
+
+    return true;
+}
+
+bool init_vertex_soa_from_vec3(vertex_soa_t *soa, const vec3_t *vertices, const int count)
+{
+    if (!init_vertex_soa(soa, count)) {
+        return false;
+    }
+
+    for (int i = 0; i < count; i++) {
+        soa->x[i] = vertices[i].x;
+        soa->y[i] = vertices[i].y;
+        soa->z[i] = vertices[i].z;
+        soa->w[i] = 1;
+    }
+
+    return true;
+}
+
+void free_vertex_soa(vertex_soa_t *soa)
+{
+    free(soa->x);
+    *soa = (vertex_soa_t) { 0 };
+}
+
+#ifndef HAVE_SSE_TRANSFORM
+static void transform_vertices_scalar(
+    const mat4_t *model_view,
+    const mat4_t *proj,
+    const vertex_soa_t *vertices,
+    vertex_soa_t *clip,
+    const int first,
+    const int end
+)
+{
+    for (int i = first; i < end; i++) {
+        const vec4_t camera_vertex = mat4_mul_vec4(*model_view, get_vertex_soa(vertices, i));
+        const vec4_t clip_vertex = mat4_mul_vec4(*proj, camera_vertex);
+
+        clip->x[i] = clip_vertex.x;
+        clip->y[i] = clip_vertex.y;
+        clip->z[i] = clip_vertex.z;
+        clip->w[i] = clip_vertex.w;
+    }
+}
+#endif
+
+#ifdef HAVE_SSE_TRANSFORM
+// 4 vertices at a time, the matrix elements are broadcast once and each row is one multiply-add chain
+static void transform_vertices_sse(
+    const mat4_t *model_view,
+    const mat4_t *proj,
+    const vertex_soa_t *vertices,
+    vertex_soa_t *clip,
+    const int first,
+    const int end
+)
+{
+    __m128 mv[4][4], p[4][4];
+    for (int row = 0; row < 4; row++) {
+        for (int col = 0; col < 4; col++) {
+            mv[row][col] = _mm_set1_ps(model_view->m[row][col]);
+            p[row][col] = _mm_set1_ps(proj->m[row][col]);
+        }
+    }
+
+    for (int i = first; i < end; i += 4) {
+        const __m128 in[4] = {
+            _mm_load_ps(vertices->x + i),
+            _mm_load_ps(vertices->y + i),
+            _mm_load_ps(vertices->z + i),
+            _mm_load_ps(vertices->w + i),
+        };
+
+        __m128 cam[4], out[4];
+        for (int row = 0; row < 4; row++) {
+            cam[row] = _mm_add_ps(
+                _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(mv[row][0], in[0]), _mm_mul_ps(mv[row][1], in[1])),
+                    _mm_mul_ps(mv[row][2], in[2])
+                ),
+                _mm_mul_ps(mv[row][3], in[3])
+            );
+        }
+        for (int row = 0; row < 4; row++) {
+            out[row] = _mm_add_ps(
+                _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(p[row][0], cam[0]), _mm_mul_ps(p[row][1], cam[1])),
+                    _mm_mul_ps(p[row][2], cam[2])
+                ),
+                _mm_mul_ps(p[row][3], cam[3])
+            );
+        }
+
+        _mm_store_ps(clip->x + i, out[0]);
+        _mm_store_ps(clip->y + i, out[1]);
+        _mm_store_ps(clip->z + i, out[2]);
+        _mm_store_ps(clip->w + i, out[3]);
+    }
+}
+#endif
+
+#ifdef HAVE_AVX_TRANSFORM
+static bool use_avx = false;
+
+// 8-wide transform_vertices_sse()
+__attribute__((target("avx"))) static void transform_vertices_avx(
+    const mat4_t *model_view,
+    const mat4_t *proj,
+    const vertex_soa_t *vertices,
+    vertex_soa_t *clip,
+    const int first,
+    const int end
+)
+{
+    __m256 mv[4][4], p[4][4];
+    for (int row = 0; row < 4; row++) {
+        for (int col = 0; col < 4; col++) {
+            mv[row][col] = _mm256_set1_ps(model_view->m[row][col]);
+            p[row][col] = _mm256_set1_ps(proj->m[row][col]);
+        }
+    }
+
+    for (int i = first; i < end; i += VERTEX_BATCH_SIZE) {
+        const __m256 in[4] = {
+            _mm256_load_ps(vertices->x + i),
+            _mm256_load_ps(vertices->y + i),
+            _mm256_load_ps(vertices->z + i),
+            _mm256_load_ps(vertices->w + i),
+        };
+
+        __m256 cam[4], out[4];
+        for (int row = 0; row < 4; row++) {
+            cam[row] = _mm256_add_ps(
+                _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(mv[row][0], in[0]), _mm256_mul_ps(mv[row][1], in[1])),
+                    _mm256_mul_ps(mv[row][2], in[2])
+                ),
+                _mm256_mul_ps(mv[row][3], in[3])
+            );
+        }
+        for (int row = 0; row < 4; row++) {
+            out[row] = _mm256_add_ps(
+                _mm256_add_ps(
+                    _mm256_add_ps(_mm256_mul_ps(p[row][0], cam[0]), _mm256_mul_ps(p[row][1], cam[1])),
+                    _mm256_mul_ps(p[row][2], cam[2])
+                ),
+                _mm256_mul_ps(p[row][3], cam[3])
+            );
+        }
+
+        _mm256_store_ps(clip->x + i, out[0]);
+        _mm256_store_ps(clip->y + i, out[1]);
+        _mm256_store_ps(clip->z + i, out[2]);
+        _mm256_store_ps(clip->w + i, out[3]);
+    }
+}
+#endif
+
+void init_vertex_kernels(void)
+{
+#ifdef HAVE_AVX_TRANSFORM
+    use_avx = SDL_HasAVX();
+#endif
+}
+
+/*
+ * Transforms count vertices from first to clip space, before the perspective divide, through camera space with the
+ * combined model-view matrix and then the projection matrix. The output must hold at least as many vertices as the
+ * input. first must be a multiple of VERTEX_BATCH_SIZE so that the batches stay aligned, and a range that ends at
+ * the last vertex has the zero padding past it transformed too.
+ */
+void transform_vertices(
+    const mat4_t *model_view,
+    const mat4_t *proj,
+    const vertex_soa_t *vertices,
+    vertex_soa_t *clip,
+    const int first,
+    const int count
+)
+{
+    const int end = first + count;
+#ifdef HAVE_AVX_TRANSFORM
+    if (use_avx) {
+        transform_vertices_avx(model_view, proj, vertices, clip, first, end);
+        return;
+    }
+#endif
+#ifdef HAVE_SSE_TRANSFORM
+    transform_vertices_sse(model_view, proj, vertices, clip, first, end);
+#else
+    transform_vertices_scalar(model_view, proj, vertices, clip, first, end);
+#endif
+}
@@ -0,0 +1,43 @@
+#ifndef VERTEX_H_
+#define VERTEX_H_
+
+#include "matrix.h"
+#include "vector.h"
+#include <stdbool.h>
+
+// Vertices transformed per step by the widest batch kernel, the streams are padded to a multiple of it
+#define VERTEX_BATCH_SIZE 8
+
+/*
+ * Vertex positions stored as separate x, y, z and w streams (structure of arrays) rather than one vec4_t per
+ * vertex, so the batch kernels load the same component of several vertices with a single aligned load. Each
+ * stream is cache line aligned and zero padded past count up to a multiple of VERTEX_BATCH_SIZE.
+ */
+typedef struct {
+	float *x;
+	float *y;
+	float *z;
+	float *w;
+	int count;
+} vertex_soa_t;
+
+bool init_vertex_soa(vertex_soa_t *soa, const int count);
+bool init_vertex_soa_from_vec3(vertex_soa_t *soa, const vec3_t *vertices, const int count);
+void free_vertex_soa(vertex_soa_t *soa);
+
+static inline vec4_t get_vertex_soa(const vertex_soa_t *soa, const int idx)
+{
+    return (vec4_t) { soa->x[idx], soa->y[idx], soa->z[idx], soa->w[idx] };
+}
+
+void init_vertex_kernels(void);
+void transform_vertices(
+    const mat4_t *model_view,
+    const mat4_t *proj,
+    const vertex_soa_t *vertices,
+    vertex_soa_t *clip,
+    const int first,
+    const int count
+);
+
+#endif // VERTEX_H_